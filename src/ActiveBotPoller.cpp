@@ -0,0 +1,161 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+
+#include "ActiveBotPoller.h"
+
+using namespace db;
+
+ActiveBotPoller::ActiveBotPoller(ConnectFunction connect, std::chrono::milliseconds interval)
+	: m_connect(connect)
+	, m_interval(interval)
+{
+	m_thread = std::thread([this]() { run(); });
+}
+
+ActiveBotPoller::~ActiveBotPoller()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	m_shutdownCV.notify_one();
+	m_thread.join();
+}
+
+ActiveBotChanges ActiveBotPoller::takeChanges(void)
+{
+	ActiveBotChanges changes;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto &entry: m_pendingBots)
+	{
+		(entry.second ? changes.activated : changes.deactivated).push_back(entry.first);
+	}
+	m_pendingBots.clear();
+
+	changes.commands.swap(m_pendingCommands);
+
+	m_hasChanges.store(false, std::memory_order_release);
+	return changes;
+}
+
+void ActiveBotPoller::run(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (!m_shutdown)
+	{
+		lock.unlock();
+
+		try
+		{
+			if (!m_database)
+			{
+				m_database = m_connect();
+			}
+			poll();
+		}
+		catch (std::exception &e)
+		{
+			std::cerr << "polling the database failed: " << e.what() << std::endl;
+
+			// reconnect on the next poll
+			m_database = nullptr;
+		}
+
+		lock.lock();
+		m_shutdownCV.wait_for(lock, m_interval, [this]() { return m_shutdown; });
+	}
+}
+
+void ActiveBotPoller::poll(void)
+{
+	// query everything first, so an error leaves the state unchanged
+	uint64_t checksum = m_database->GetActiveBotsChecksum();
+	bool botsChanged = !m_hasChecksum || (checksum != m_checksum)
+		|| (m_pollsSinceFetch + 1 >= FULL_FETCH_INTERVAL);
+
+	std::vector<int> activeIdList;
+	if (botsChanged)
+	{
+		activeIdList = m_database->GetActiveBotIds();
+	}
+
+	auto activeCommands = m_database->GetActiveCommands();
+
+	std::vector<int> activated;
+	std::vector<int> deactivated;
+	if (botsChanged)
+	{
+		std::unordered_set<int> activeIds(activeIdList.begin(), activeIdList.end());
+
+		for (int id: activeIds)
+		{
+			if (m_activeIds.count(id) == 0)
+			{
+				activated.push_back(id);
+			}
+		}
+
+		for (int id: m_activeIds)
+		{
+			if (activeIds.count(id) == 0)
+			{
+				deactivated.push_back(id);
+			}
+		}
+
+		m_activeIds.swap(activeIds);
+		m_checksum = checksum;
+		m_hasChecksum = true;
+		m_pollsSinceFetch = 0;
+	}
+	else
+	{
+		m_pollsSinceFetch++;
+	}
+
+	// a command stays in the result until its completion was written
+	std::vector<Command> commands;
+	std::unordered_set<long> reportedCommands;
+	for (auto &cmd: activeCommands)
+	{
+		reportedCommands.insert(cmd.id);
+		if (m_reportedCommands.count(cmd.id) == 0)
+		{
+			commands.push_back(cmd);
+		}
+	}
+	m_reportedCommands.swap(reportedCommands);
+
+	if (activated.empty() && deactivated.empty() && commands.empty())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (int id: activated) { m_pendingBots[id] = true; }
+	for (int id: deactivated) { m_pendingBots[id] = false; }
+	m_pendingCommands.insert(m_pendingCommands.end(), commands.begin(), commands.end());
+
+	m_hasChanges.store(true, std::memory_order_release);
+}
@@ -0,0 +1,105 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Database.h"
+
+namespace db
+{
+	/*!
+	 * Changes of the active bots and new commands since the last call to
+	 * ActiveBotPoller::takeChanges().
+	 */
+	struct ActiveBotChanges
+	{
+		std::vector<int> activated;
+		std::vector<int> deactivated;
+		std::vector<Command> commands;
+	};
+
+	/*!
+	 * \brief Polls the active bots and commands on a background thread.
+	 *
+	 * The set of active bots is only fetched when its checksum changed, or
+	 * every FULL_FETCH_INTERVAL polls in case of a checksum collision, and
+	 * then compared to the previously fetched set. Only the differences are
+	 * handed to the game thread; if a bot changes more than once before they
+	 * are taken, its latest state wins.
+	 *
+	 * Commands are reported once, even if they are still unprocessed in the
+	 * database at the next poll.
+	 */
+	class ActiveBotPoller
+	{
+		public:
+			/*!
+			 * \param connect    Creates the connection for the poll thread;
+			 *                   called again after an error.
+			 * \param interval   Time between two polls.
+			 */
+			ActiveBotPoller(ConnectFunction connect, std::chrono::milliseconds interval);
+			~ActiveBotPoller();
+
+			ActiveBotPoller(const ActiveBotPoller&) = delete;
+			ActiveBotPoller& operator=(const ActiveBotPoller&) = delete;
+
+			/*!
+			 * Cheap check for the game thread, which does not lock.
+			 */
+			bool hasChanges(void) const { return m_hasChanges.load(std::memory_order_acquire); }
+
+			ActiveBotChanges takeChanges(void);
+
+		private:
+			static constexpr const unsigned FULL_FETCH_INTERVAL = 30;
+
+			ConnectFunction m_connect;
+			std::chrono::milliseconds m_interval;
+
+			std::mutex m_mutex;
+			std::condition_variable m_shutdownCV;
+			bool m_shutdown = false;
+
+			std::unordered_map<int, bool> m_pendingBots; // bot id -> active
+			std::vector<Command> m_pendingCommands;
+			std::atomic<bool> m_hasChanges{false};
+
+			// only used by the poll thread
+			std::unique_ptr<IDatabase> m_database;
+			bool m_hasChecksum = false;
+			uint64_t m_checksum = 0;
+			unsigned m_pollsSinceFetch = 0;
+			std::unordered_set<int> m_activeIds;
+			std::unordered_set<long> m_reportedCommands;
+
+			std::thread m_thread;
+
+			void run(void);
+			void poll(void);
+	};
+}
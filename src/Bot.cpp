@@ -29,7 +29,6 @@ Bot::Bot(Field *field, uint32_t startFrame, std::unique_ptr<db::BotScript> dbDat
 	, m_dbData(std::move(dbData))
 {
 	m_snake = std::make_shared<Snake>(field, startPos, 5, startHeading);
-	m_lua_bot = std::make_unique<LuaBot>(*this, m_dbData->code);
 }
 
 Bot::~Bot()
@@ -42,6 +41,9 @@ Bot::~Bot()
 
 bool Bot::init(std::string& initErrorMessage)
 {
+	// the Lua state is created here and not in the constructor, so it can
+	// be done in parallel for many bots
+	m_lua_bot = std::make_unique<LuaBot>(*this, m_dbData->code);
 	return m_lua_bot->init(initErrorMessage);
 }
 
@@ -54,6 +56,9 @@ std::size_t Bot::move(void)
 		boost = false;
 		directionChange = 0;
 	}
+
+	m_lastDirectionChange = directionChange;
+	m_lastBoost = boost;
 	return m_snake->move(directionChange, boost);
 }
 
@@ -91,6 +96,35 @@ std::shared_ptr<Bot> Bot::checkCollision(void) const
 	return retval;
 }
 
+void Bot::findConsumableFood(std::vector<Food*> &food) const
+{
+	Vector2D headPos = m_snake->getHeadPosition();
+	real_t radius = m_snake->getConsumeRadius();
+
+	for (auto &fi: m_field->getFoodMap().getRegion(headPos, radius))
+	{
+		if (!fi.shallBeRemoved() && m_snake->canConsume(fi))
+		{
+			food.push_back(&fi);
+		}
+	}
+}
+
+void Bot::consumeFood(const std::vector<Food*> &food)
+{
+	std::shared_ptr<Bot> self = shared_from_this();
+	UpdateTracker &tracker = m_field->getUpdateTracker();
+
+	for (Food *fi: food)
+	{
+		m_snake->consume(*fi);
+		updateConsumeStats(*fi);
+		tracker.foodConsumed(*fi, self);
+	}
+
+	m_snake->ensureSizeMatchesMass();
+}
+
 void Bot::updateConsumeStats(const Food &food)
 {
 	std::shared_ptr<Bot> hunter = food.getHunter();
@@ -107,6 +141,30 @@ void Bot::updateConsumeStats(const Food &food)
 	}
 }
 
+void Bot::saveState(Checkpoint::BotRecord &record, std::vector<Checkpoint::SegmentRecord> &segments) const
+{
+	record.databaseId = m_dbData->bot_id;
+	record.startFrame = m_startFrame;
+	record.consumedNaturalFood = m_consumedNaturalFood;
+	record.consumedFoodHuntedByOthers = m_consumedFoodHuntedByOthers;
+	record.consumedFoodHuntedBySelf = m_consumedFoodHuntedBySelf;
+	record.logCredit = m_logCredit;
+	record.reserved = 0;
+
+	m_snake->saveState(record, segments);
+}
+
+void Bot::restoreState(const Checkpoint::BotRecord &record, const Checkpoint::SegmentRecord *segments)
+{
+	m_startFrame = record.startFrame;
+	m_consumedNaturalFood = record.consumedNaturalFood;
+	m_consumedFoodHuntedByOthers = record.consumedFoodHuntedByOthers;
+	m_consumedFoodHuntedBySelf = record.consumedFoodHuntedBySelf;
+	m_logCredit = record.logCredit;
+
+	m_snake->restoreState(record, segments);
+}
+
 void Bot::increaseLogCredit()
 {
 	m_logCredit = std::min(
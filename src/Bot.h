@@ -35,7 +35,7 @@ class GlobalView;
 /*!
  * A bot playing this game.
  */
-class Bot : public IdentifyableObject
+class Bot : public IdentifyableObject, public std::enable_shared_from_this<Bot>
 {
 	private:
 		Field *m_field;
@@ -50,6 +50,9 @@ class Bot : public IdentifyableObject
 		real_t m_consumedFoodHuntedByOthers = 0;
 		real_t m_consumedNaturalFood = 0;
 
+		real_t m_lastDirectionChange = 0; //!< as returned by the script, before limiting
+		bool m_lastBoost = false;
+
 	public:
 		/*!
 		 * Creates a new bot identified by the given name on the given playing
@@ -60,6 +63,9 @@ class Bot : public IdentifyableObject
 
 		/*!
 		 * \brief init
+		 *
+		 * Creates the Lua state and runs the script. Does not modify the
+		 * field, so different bots can be initialized in parallel.
 		 * initialize the bot, e.g. parse the lua script
 		 * \return true if init successful, false if failed
 		 */
@@ -81,6 +87,22 @@ class Bot : public IdentifyableObject
 		 */
 		std::shared_ptr<Bot> checkCollision(void) const;
 
+		/*!
+		 * Collect the Food the Snake's head can reach. Only reads the Field,
+		 * so it runs for all bots in parallel; which bot actually consumes
+		 * the Food is decided by Field::consumeFood().
+		 *
+		 * \param food   Output: the reachable Food that is not removed yet.
+		 */
+		void findConsumableFood(std::vector<Food*> &food) const;
+
+		/*!
+		 * Consume the Food claimed for this bot by Field::consumeFood() and
+		 * grow the Snake accordingly. Only changes this bot, so it runs for
+		 * all bots in parallel; the events are buffered by the tracker.
+		 */
+		void consumeFood(const std::vector<Food*> &food);
+
 		/*!
 		 * \brief increase log credit every frame, until config::LOG_MAX_CREDITS is reached
 		 */
@@ -95,12 +117,28 @@ class Bot : public IdentifyableObject
 		LuaBot& getLuaBot() { return *m_lua_bot; }
 		uint32_t getStartFrame() { return m_startFrame; }
 
+		/*!
+		 * The script's decision in the last call to move().
+		 */
+		real_t getLastDirectionChange(void) const { return m_lastDirectionChange; }
+		bool getLastBoost(void) const { return m_lastBoost; }
+
 		real_t getConsumedNaturalFood(void) { return m_consumedNaturalFood; }
 		real_t getConsumedFoodHuntedByOthers(void) { return m_consumedFoodHuntedByOthers; }
 		real_t getConsumedFoodHuntedBySelf(void) { return m_consumedFoodHuntedBySelf; }
 
 		void updateConsumeStats(const Food &food);
 
+		/*!
+		 * Store the state of the bot and its snake for a checkpoint.
+		 */
+		void saveState(Checkpoint::BotRecord &record, std::vector<Checkpoint::SegmentRecord> &segments) const;
+
+		/*!
+		 * Continue from a checkpoint. The bot keeps its script and GUID.
+		 */
+		void restoreState(const Checkpoint::BotRecord &record, const Checkpoint::SegmentRecord *segments);
+
 		uint64_t getViewerKey() { return m_dbData->viewer_key; }
 
 		bool appendLogMessage(const std::string &data, bool checkCredit);
@@ -24,6 +24,8 @@
 
 #include "BotThreadPool.h"
 
+std::atomic<std::size_t> BotThreadPool::s_runningJobs(0);
+
 BotThreadPool::BotThreadPool(std::size_t num_threads)
 	: m_threads(num_threads), m_activeThreads(0)
 {
@@ -55,6 +57,8 @@ BotThreadPool::BotThreadPool(std::size_t num_threads)
 							}
 
 							if(currentJob) {
+								s_runningJobs++;
+
 								switch(currentJob->jobType) {
 									case Move:
 										currentJob->steps = currentJob->bot->move();
@@ -63,8 +67,22 @@ BotThreadPool::BotThreadPool(std::size_t num_threads)
 									case CollisionCheck:
 										currentJob->killer = currentJob->bot->checkCollision();
 										break;
+
+									case Init:
+										currentJob->initSuccessful = currentJob->bot->init(currentJob->initErrorMessage);
+										break;
+
+									case FindFood:
+										currentJob->bot->findConsumableFood(currentJob->food);
+										break;
+
+									case ConsumeFood:
+										currentJob->bot->consumeFood(currentJob->food);
+										break;
 								}
 
+								s_runningJobs--;
+
 								std::lock_guard<std::mutex> processedQueueGuard(m_processedQueueMutex);
 								m_processedJobs.push(std::move(currentJob));
 							}
@@ -25,18 +25,23 @@
 #include <condition_variable>
 
 #include <queue>
+#include <string>
 
 #include "Semaphore.h"
 
 // forward declaration
 class Bot;
+class Food;
 
 class BotThreadPool
 {
 	public:
 		enum JobType {
 			Move,
-			CollisionCheck
+			CollisionCheck,
+			Init,
+			FindFood,
+			ConsumeFood
 		};
 
 		struct Job {
@@ -50,6 +55,11 @@ class BotThreadPool
 			std::size_t steps;
 			// for jobType == CollisionCheck
 			std::shared_ptr<Bot> killer;
+			// for jobType == Init
+			bool initSuccessful;
+			std::string initErrorMessage;
+			// for jobType == FindFood (output) and ConsumeFood (input)
+			std::vector<Food*> food;
 
 			Job(JobType type, const std::shared_ptr<Bot> myBot)
 				: jobType(type), bot(myBot)
@@ -73,6 +83,8 @@ class BotThreadPool
 
 		std::size_t m_activeThreads;
 
+		static std::atomic<std::size_t> s_runningJobs; // in all pools
+
 	public:
 		BotThreadPool(std::size_t num_threads);
 
@@ -102,4 +114,9 @@ class BotThreadPool
 		 *          NULL if queue is empty.
 		 */
 		std::unique_ptr<Job> getProcessedJob(void);
+
+		/*!
+		 * \returns   true if a job of any pool is being processed.
+		 */
+		static bool isAnyJobRunning(void) { return s_runningJobs > 0; }
 };
@@ -0,0 +1,222 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Checkpoint.h"
+
+static const char CHECKPOINT_MAGIC[8] = {'S', 'P', 'N', 'C', 'K', 'P', 'T', '\0'};
+static const uint32_t CHECKPOINT_BYTE_ORDER = 0x01020304;
+static const uint64_t CHECKPOINT_ALIGNMENT = 8;
+
+static uint64_t align(uint64_t offset)
+{
+	return (offset + CHECKPOINT_ALIGNMENT - 1) & ~(CHECKPOINT_ALIGNMENT - 1);
+}
+
+static std::runtime_error systemError(const std::string &what, const std::string &filename)
+{
+	return std::runtime_error(what + " " + filename + ": " + std::strerror(errno));
+}
+
+void Checkpoint::write(const std::string &filename) const
+{
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = FORMAT_VERSION;
+	header.byteOrder = CHECKPOINT_BYTE_ORDER;
+	header.frame = frame;
+	header.fieldWidth = fieldWidth;
+	header.fieldHeight = fieldHeight;
+
+	header.foodOffset = align(sizeof(Header));
+	header.foodCount = food.size();
+	header.botOffset = align(header.foodOffset + food.size() * sizeof(FoodRecord));
+	header.botCount = bots.size();
+	header.segmentOffset = align(header.botOffset + bots.size() * sizeof(BotRecord));
+	header.segmentCount = segments.size();
+	header.randomStateOffset = align(header.segmentOffset + segments.size() * sizeof(SegmentRecord));
+	header.randomStateSize = randomState.size();
+
+	std::string tempFilename = filename + ".tmp";
+	FILE *file = std::fopen(tempFilename.c_str(), "wb");
+	if (file == nullptr)
+	{
+		throw systemError("cannot create", tempFilename);
+	}
+
+	uint64_t position = 0;
+	auto put = [&](uint64_t offset, const void *data, std::size_t size)
+	{
+		static const char padding[CHECKPOINT_ALIGNMENT] = {0};
+		bool ok = (std::fwrite(padding, 1, offset - position, file) == offset - position)
+			&& ((size == 0) || (std::fwrite(data, 1, size, file) == size));
+		position = offset + size;
+		return ok;
+	};
+
+	bool ok = put(0, &header, sizeof(header))
+		&& put(header.foodOffset, food.data(), food.size() * sizeof(FoodRecord))
+		&& put(header.botOffset, bots.data(), bots.size() * sizeof(BotRecord))
+		&& put(header.segmentOffset, segments.data(), segments.size() * sizeof(SegmentRecord))
+		&& put(header.randomStateOffset, randomState.data(), randomState.size())
+		&& (std::fflush(file) == 0)
+		&& (fsync(fileno(file)) == 0);
+
+	if (!ok)
+	{
+		std::runtime_error error = systemError("cannot write", tempFilename);
+		std::fclose(file);
+		std::remove(tempFilename.c_str());
+		throw error;
+	}
+
+	if (std::fclose(file) != 0)
+	{
+		throw systemError("cannot write", tempFilename);
+	}
+
+	if (std::rename(tempFilename.c_str(), filename.c_str()) != 0)
+	{
+		throw systemError("cannot replace", filename);
+	}
+}
+
+MappedCheckpoint::MappedCheckpoint(void *data, std::size_t size)
+	: m_data(data)
+	, m_size(size)
+	, m_header(static_cast<const Checkpoint::Header*>(data))
+{
+}
+
+MappedCheckpoint::~MappedCheckpoint()
+{
+	munmap(m_data, m_size);
+}
+
+std::unique_ptr<MappedCheckpoint> MappedCheckpoint::open(const std::string &filename)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		if (errno == ENOENT)
+		{
+			return nullptr;
+		}
+		throw systemError("cannot open", filename);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		std::runtime_error error = systemError("cannot stat", filename);
+		close(fd);
+		throw error;
+	}
+
+	std::size_t size = static_cast<std::size_t>(st.st_size);
+	if (size < sizeof(Checkpoint::Header))
+	{
+		close(fd);
+		throw std::runtime_error(filename + " is too short for a checkpoint");
+	}
+
+	void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		throw systemError("cannot map", filename);
+	}
+
+	std::unique_ptr<MappedCheckpoint> checkpoint(new MappedCheckpoint(data, size));
+	checkpoint->validate(filename);
+	return checkpoint;
+}
+
+void MappedCheckpoint::validate(const std::string &filename) const
+{
+	const Checkpoint::Header &header = *m_header;
+
+	if ((std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0)
+			|| (header.byteOrder != CHECKPOINT_BYTE_ORDER)
+			|| (header.version != Checkpoint::FORMAT_VERSION))
+	{
+		throw std::runtime_error(filename + " is not a checkpoint of this version");
+	}
+
+	auto fits = [this](uint64_t offset, uint64_t count, uint64_t recordSize)
+	{
+		return ((offset % CHECKPOINT_ALIGNMENT) == 0)
+			&& (offset <= m_size)
+			&& (count <= (m_size - offset) / recordSize);
+	};
+
+	if (!fits(header.foodOffset, header.foodCount, sizeof(Checkpoint::FoodRecord))
+			|| !fits(header.botOffset, header.botCount, sizeof(Checkpoint::BotRecord))
+			|| !fits(header.segmentOffset, header.segmentCount, sizeof(Checkpoint::SegmentRecord))
+			|| !fits(header.randomStateOffset, header.randomStateSize, 1))
+	{
+		throw std::runtime_error(filename + " is truncated");
+	}
+
+	for (auto &bot: getBots())
+	{
+		// a snake has at least two segments, see Snake::ensureSizeMatchesMass()
+		if ((bot.segmentCount < 2)
+				|| (bot.firstSegment > header.segmentCount)
+				|| (bot.segmentCount > header.segmentCount - bot.firstSegment))
+		{
+			throw std::runtime_error(filename + " contains invalid snake segments");
+		}
+	}
+}
+
+template <class T>
+MappedCheckpoint::RecordArray<T> MappedCheckpoint::records(uint64_t offset, uint64_t count) const
+{
+	return {reinterpret_cast<const T*>(static_cast<const char*>(m_data) + offset), static_cast<std::size_t>(count)};
+}
+
+MappedCheckpoint::RecordArray<Checkpoint::FoodRecord> MappedCheckpoint::getFood(void) const
+{
+	return records<Checkpoint::FoodRecord>(m_header->foodOffset, m_header->foodCount);
+}
+
+MappedCheckpoint::RecordArray<Checkpoint::BotRecord> MappedCheckpoint::getBots(void) const
+{
+	return records<Checkpoint::BotRecord>(m_header->botOffset, m_header->botCount);
+}
+
+MappedCheckpoint::RecordArray<Checkpoint::SegmentRecord> MappedCheckpoint::getSegments(void) const
+{
+	return records<Checkpoint::SegmentRecord>(m_header->segmentOffset, m_header->segmentCount);
+}
+
+std::string MappedCheckpoint::getRandomState(void) const
+{
+	return std::string(static_cast<const char*>(m_data) + m_header->randomStateOffset, m_header->randomStateSize);
+}
@@ -0,0 +1,146 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+/*!
+ * \brief State of the Field, from which the game is resumed after a restart.
+ *
+ * The file starts with a Header, followed by the arrays of food, bot and
+ * segment records and the state of the random generator. All records have
+ * a fixed size and are stored in native byte order at aligned offsets, so a
+ * mapped file (see MappedCheckpoint) is read in place. The Lua state of the
+ * bots is not saved; their scripts are started again.
+ */
+struct Checkpoint
+{
+	static constexpr const uint32_t FORMAT_VERSION = 1;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		uint32_t frame;
+		real_t fieldWidth;
+		real_t fieldHeight;
+		uint32_t reserved;
+		uint64_t foodOffset, foodCount;
+		uint64_t botOffset, botCount;
+		uint64_t segmentOffset, segmentCount;
+		uint64_t randomStateOffset, randomStateSize;
+	};
+
+	struct FoodRecord
+	{
+		real_t x, y;
+		real_t value;
+		int32_t hunterDatabaseId; //!< -1 if not hunted
+		uint32_t shallRegenerate;
+	};
+
+	struct BotRecord
+	{
+		int32_t databaseId;
+		uint32_t startFrame;
+		uint64_t firstSegment; //!< index into the segment records, head first
+		uint64_t segmentCount;
+		real_t mass;
+		real_t heading;
+		real_t movedSinceLastSpawn;
+		real_t foodToDrop;
+		real_t consumedNaturalFood;
+		real_t consumedFoodHuntedByOthers;
+		real_t consumedFoodHuntedBySelf;
+		real_t logCredit;
+		uint32_t boostedLastMove;
+		uint32_t reserved;
+	};
+
+	struct SegmentRecord
+	{
+		real_t x, y;
+	};
+
+	uint32_t frame = 0;
+	real_t fieldWidth = 0;
+	real_t fieldHeight = 0;
+	std::vector<FoodRecord> food;
+	std::vector<BotRecord> bots;
+	std::vector<SegmentRecord> segments;
+	std::string randomState; //!< text representation of the generator and distributions
+
+	/*!
+	 * Write the checkpoint to a temporary file, which then replaces the given
+	 * file. An existing checkpoint therefore stays intact if writing fails.
+	 *
+	 * \throws std::runtime_error on I/O errors.
+	 */
+	void write(const std::string &filename) const;
+};
+
+/*!
+ * \brief Read-only view of a checkpoint file mapped into memory.
+ */
+class MappedCheckpoint
+{
+	public:
+		template <class T> struct RecordArray
+		{
+			const T *data;
+			std::size_t count;
+
+			const T* begin() const { return data; }
+			const T* end() const { return data + count; }
+			const T& operator[](std::size_t i) const { return data[i]; }
+		};
+
+		/*!
+		 * \returns   nullptr if the file does not exist.
+		 * \throws std::runtime_error if the file is not a valid checkpoint.
+		 */
+		static std::unique_ptr<MappedCheckpoint> open(const std::string &filename);
+
+		~MappedCheckpoint();
+
+		MappedCheckpoint(const MappedCheckpoint&) = delete;
+		MappedCheckpoint& operator=(const MappedCheckpoint&) = delete;
+
+		const Checkpoint::Header& getHeader(void) const { return *m_header; }
+		RecordArray<Checkpoint::FoodRecord> getFood(void) const;
+		RecordArray<Checkpoint::BotRecord> getBots(void) const;
+		RecordArray<Checkpoint::SegmentRecord> getSegments(void) const;
+		std::string getRandomState(void) const;
+
+	private:
+		MappedCheckpoint(void *data, std::size_t size);
+
+		void *m_data;
+		std::size_t m_size;
+		const Checkpoint::Header *m_header;
+
+		void validate(const std::string &filename) const;
+		template <class T> RecordArray<T> records(uint64_t offset, uint64_t count) const;
+};
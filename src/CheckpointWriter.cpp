@@ -0,0 +1,69 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+
+#include "CheckpointWriter.h"
+
+constexpr const int CheckpointWriter::SNAPSHOT_TIMEOUT_MS;
+
+CheckpointWriter::CheckpointWriter(const std::string &filename, SnapshotPublisher &snapshots, std::chrono::milliseconds interval)
+	: m_filename(filename)
+	, m_snapshots(snapshots)
+	, m_interval(interval)
+{
+	m_thread = std::thread([this]() { run(); });
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	m_shutdownCV.notify_one();
+	m_thread.join();
+}
+
+void CheckpointWriter::run(void)
+{
+	uint64_t epoch = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (!m_shutdownCV.wait_for(lock, m_interval, [this]() { return m_shutdown; }))
+	{
+		lock.unlock();
+
+		auto snapshot = m_snapshots.waitForSnapshot(epoch, std::chrono::milliseconds(SNAPSHOT_TIMEOUT_MS));
+		if (snapshot)
+		{
+			epoch = snapshot->epoch;
+
+			try
+			{
+				snapshot->write(m_filename);
+			}
+			catch (std::exception &e)
+			{
+				std::cerr << "writing the checkpoint failed: " << e.what() << std::endl;
+			}
+		}
+
+		lock.lock();
+	}
+}
@@ -0,0 +1,61 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "FieldSnapshot.h"
+
+/*!
+ * \brief Writes checkpoints periodically on a background thread.
+ *
+ * The state is taken from the snapshots of the field, so the game thread
+ * only copies it and never waits for the disk.
+ */
+class CheckpointWriter
+{
+	public:
+		/*!
+		 * \param interval   Time between two checkpoints.
+		 */
+		CheckpointWriter(const std::string &filename, SnapshotPublisher &snapshots, std::chrono::milliseconds interval);
+		~CheckpointWriter();
+
+		CheckpointWriter(const CheckpointWriter&) = delete;
+		CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+	private:
+		static constexpr const int SNAPSHOT_TIMEOUT_MS = 1000;
+
+		std::string m_filename;
+		SnapshotPublisher &m_snapshots;
+		std::chrono::milliseconds m_interval;
+
+		std::mutex m_mutex;
+		std::condition_variable m_shutdownCV;
+		bool m_shutdown = false;
+
+		std::thread m_thread;
+
+		void run(void);
+};
@@ -0,0 +1,290 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <TcpServer/TcpServer.h>
+
+#include "FrameCompressor.h"
+#include "ClientConnection.h"
+
+ClientConnection::ClientConnection(TcpSocket &socket, std::size_t maxQueuedBytes)
+	: m_fd(dup(socket.GetFileDescriptor()))
+	, m_peer(socket.GetPeer())
+	, m_maxQueuedBytes(maxQueuedBytes)
+{
+	if (m_fd < 0)
+	{
+		std::cerr << "cannot duplicate socket of " << m_peer << ": " << strerror(errno) << std::endl;
+		m_failed = true;
+	}
+}
+
+ClientConnection::~ClientConnection()
+{
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+	}
+}
+
+void ClientConnection::enqueue(const SharedBuffer &buffer, bool protect)
+{
+	SharedBuffer data = m_compressor ? m_compressor->compress(buffer) : buffer;
+
+	m_sendQueue.push_back(data);
+	m_queuedBytes += data->size();
+
+	if (protect)
+	{
+		// the stream must stay intact up to this buffer
+		m_protectedBuffers = m_sendQueue.size();
+		m_liveBytes = 0;
+	}
+	else
+	{
+		m_liveBytes += data->size();
+	}
+}
+
+void ClientConnection::dropPending(void)
+{
+	// a partially sent buffer must be completed to keep the stream intact
+	std::size_t keep = std::max<std::size_t>((m_sendOffset > 0) ? 1 : 0, m_protectedBuffers);
+
+	while (m_sendQueue.size() > keep)
+	{
+		m_queuedBytes -= m_sendQueue.back()->size();
+		m_liveBytes -= m_sendQueue.back()->size();
+		m_sendQueue.pop_back();
+		m_droppedFrames++;
+	}
+}
+
+bool ClientConnection::send(const SharedBuffer &buffer)
+{
+	if (m_failed || buffer->empty())
+	{
+		return true;
+	}
+
+	if (m_resyncPending)
+	{
+		m_droppedFrames++;
+		return false;
+	}
+
+	// checked against the uncompressed size, which is known without
+	// compressing a buffer that might be dropped
+	if (m_liveBytes + buffer->size() > m_maxQueuedBytes)
+	{
+		dropPending();
+		m_droppedFrames++;
+		m_resyncPending = true;
+		return false;
+	}
+
+	enqueue(buffer, false);
+	return true;
+}
+
+void ClientConnection::resync(const SharedBuffer &keyframe, const std::vector<SharedBuffer> &frames)
+{
+	if (m_resyncPending)
+	{
+		m_resyncPending = false;
+		m_resyncCount++;
+	}
+
+	if (m_failed)
+	{
+		return;
+	}
+
+	// this may exceed the limit on its own
+	enqueue(keyframe, true);
+
+	for (auto &frame: frames)
+	{
+		if (!frame->empty())
+		{
+			enqueue(frame, true);
+		}
+	}
+}
+
+void ClientConnection::setCompression(FrameCompressor *compressor, const SharedBuffer &announcement)
+{
+	if (!m_failed)
+	{
+		enqueue(announcement, true);
+	}
+
+	m_compressor = compressor;
+}
+
+bool ClientConnection::flush(void)
+{
+	while (!m_failed && !m_sendQueue.empty())
+	{
+		struct iovec iov[MAX_IOVECS];
+		int iovcnt = 0;
+
+		std::size_t offset = m_sendOffset;
+		for (auto &buffer: m_sendQueue)
+		{
+			if (iovcnt >= MAX_IOVECS) { break; }
+
+			iov[iovcnt].iov_base = const_cast<char*>(buffer->data() + offset);
+			iov[iovcnt].iov_len = buffer->size() - offset;
+			iovcnt++;
+			offset = 0;
+		}
+
+		struct msghdr msg = {};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+
+		ssize_t written = sendmsg(m_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (written < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+			{
+				// socket buffer is full, continue with the next flush
+				return true;
+			}
+
+			std::cerr << "cannot send to " << m_peer << ": " << strerror(errno) << std::endl;
+			m_failed = true;
+			break;
+		}
+
+		// drop everything that was sent completely
+		std::size_t remaining = static_cast<std::size_t>(written);
+		m_queuedBytes -= remaining;
+		while (remaining > 0)
+		{
+			std::size_t frontLeft = m_sendQueue.front()->size() - m_sendOffset;
+			if (remaining < frontLeft)
+			{
+				m_sendOffset += remaining;
+				break;
+			}
+
+			remaining -= frontLeft;
+			if (m_protectedBuffers > 0)
+			{
+				m_protectedBuffers--;
+			}
+			else
+			{
+				m_liveBytes -= m_sendQueue.front()->size();
+			}
+			m_sendQueue.pop_front();
+			m_sendOffset = 0;
+		}
+	}
+
+	if (m_failed)
+	{
+		m_sendQueue.clear();
+		m_sendOffset = 0;
+		m_queuedBytes = 0;
+		m_liveBytes = 0;
+		m_protectedBuffers = 0;
+	}
+
+	return !m_failed;
+}
+
+bool ClientConnection::sendFile(int fd, off_t &offset, off_t end)
+{
+	// the file data follows everything that is queued
+	if (!flush() || !m_sendQueue.empty())
+	{
+		return !m_failed;
+	}
+
+	while (offset < end)
+	{
+		ssize_t written = sendfile(m_fd, fd, &offset, static_cast<std::size_t>(end - offset));
+		if (written < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+			{
+				return true;
+			}
+
+			std::cerr << "cannot send to " << m_peer << ": " << strerror(errno) << std::endl;
+			m_failed = true;
+			return false;
+		}
+
+		if (written == 0)
+		{
+			// the file is shorter than expected
+			std::cerr << "cannot send to " << m_peer << ": unexpected end of file" << std::endl;
+			m_failed = true;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void ClientConnection::receive(const char *data, std::size_t size)
+{
+	m_receiveBuffer.append(data, size);
+}
+
+bool ClientConnection::nextMessage(std::string &message)
+{
+	uint32_t length;
+	if (m_receiveBuffer.size() < sizeof(length))
+	{
+		return false;
+	}
+
+	std::memcpy(&length, m_receiveBuffer.data(), sizeof(length));
+	length = ntohl(length);
+
+	if (length > MAX_RECEIVE_MESSAGE_SIZE)
+	{
+		std::cerr << "message from " << m_peer << " is too long, discarding input." << std::endl;
+		m_receiveBuffer.clear();
+		return false;
+	}
+
+	if (m_receiveBuffer.size() < sizeof(length) + length)
+	{
+		return false;
+	}
+
+	message.assign(m_receiveBuffer, sizeof(length), length);
+	m_receiveBuffer.erase(0, sizeof(length) + length);
+	return true;
+}
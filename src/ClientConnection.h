@@ -0,0 +1,199 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "MsgPackProtocol.h"
+#include "SharedBuffer.h"
+#include "Viewport.h"
+
+class TcpSocket;
+class FrameCompressor;
+
+/*!
+ * What a client requested for its update stream.
+ */
+struct ClientSettings
+{
+	uint8_t protocolVersion = MsgPackProtocol::PROTOCOL_VERSION;
+	uint8_t compression = MsgPackProtocol::COMPRESSION_NONE;
+
+	bool hasViewport = false;
+	viewport::TileSet viewportTiles;
+
+	/*!
+	 * \returns   The tiles the client is interested in, or nullptr if it
+	 *            wants updates for the whole field.
+	 */
+	const viewport::TileSet* getViewportTiles(void) const
+	{
+		return hasViewport ? &viewportTiles : nullptr;
+	}
+};
+
+/*!
+ * A connected viewer and its queue of outgoing data.
+ *
+ * The connection writes on its own duplicate of the socket's file
+ * descriptor. Queued buffers are sent with one scatter/gather call per
+ * flush() and are never copied.
+ *
+ * If compression is enabled, buffers are replaced by their compressed
+ * blocks when they are queued.
+ *
+ * receive() and nextMessage() are used by the thread handling input, all
+ * other methods by the network thread; they share no state.
+ */
+class ClientConnection
+{
+	private:
+		static constexpr const int MAX_IOVECS = 64;
+		static constexpr const std::size_t MAX_RECEIVE_MESSAGE_SIZE = 64*1024;
+
+		int m_fd;
+		std::string m_peer;
+
+		std::deque<SharedBuffer> m_sendQueue;
+		std::size_t m_sendOffset = 0;  //!< bytes of the first queued buffer that were already sent
+		std::size_t m_queuedBytes = 0;
+		std::size_t m_liveBytes = 0;        //!< bytes of the queued buffers that may be dropped
+		std::size_t m_protectedBuffers = 0; //!< number of buffers at the front that must not be dropped
+		std::size_t m_maxQueuedBytes;
+		bool m_failed = false;
+
+		bool m_resyncPending = false;
+		uint64_t m_droppedFrames = 0;
+		uint64_t m_resyncCount = 0;
+
+		FrameCompressor *m_compressor = nullptr;
+
+		/*!
+		 * \param protect   Never drop this buffer and everything queued
+		 *                  before it.
+		 */
+		void enqueue(const SharedBuffer &buffer, bool protect);
+		void dropPending(void);
+
+		std::string m_receiveBuffer;
+
+		ClientSettings m_settings;
+
+	public:
+		ClientConnection(TcpSocket &socket, std::size_t maxQueuedBytes);
+		~ClientConnection();
+
+		ClientConnection(const ClientConnection&) = delete;
+		ClientConnection& operator=(const ClientConnection&) = delete;
+
+		/*!
+		 * Append a buffer to the send queue.
+		 *
+		 * If the live buffers in the queue would grow beyond the limit, all of
+		 * them that were not started yet are dropped and the client needs a
+		 * resync. Until then, further buffers are dropped, too. Protected
+		 * buffers (see resync()) are neither dropped nor counted.
+		 *
+		 * \returns   false if the buffer was dropped.
+		 */
+		bool send(const SharedBuffer &buffer);
+
+		/*!
+		 * Queue a keyframe and the frames following it, for a new client or
+		 * one that needs a resync, and continue with normal updates
+		 * afterwards.
+		 *
+		 * The payload is protected: dropPending() keeps it and everything
+		 * queued before it, and it does not count against the limit for the
+		 * live frames following it.
+		 */
+		void resync(const SharedBuffer &keyframe, const std::vector<SharedBuffer> &frames);
+
+		/*!
+		 * \returns   true if frames were dropped and the previous resync
+		 *            payload was sent completely, so a new one can be queued
+		 *            without piling up keyframes for a slow client.
+		 */
+		bool needsResync(void) const { return m_resyncPending && (m_protectedBuffers == 0); }
+
+		/*!
+		 * Switch the compression of the outgoing stream.
+		 *
+		 * The announcement is queued protected (see resync()) in the current
+		 * mode, so it tells the client where the stream changes even if the
+		 * frames around it are dropped.
+		 *
+		 * \param compressor     Compressor for all further buffers, or
+		 *                       nullptr to send them uncompressed.
+		 * \param announcement   Message announcing the new mode.
+		 */
+		void setCompression(FrameCompressor *compressor, const SharedBuffer &announcement);
+
+		bool isCompressed(void) const { return m_compressor != nullptr; }
+
+		/*!
+		 * Write as much of the send queue as the socket accepts without
+		 * blocking.
+		 *
+		 * \returns   false if the connection has failed.
+		 */
+		bool flush(void);
+
+		/*!
+		 * Send a range of a file directly from the page cache, after the
+		 * send queue was written completely. Sends as much as the socket
+		 * accepts without blocking.
+		 *
+		 * \param offset   Start of the range; advanced by the bytes sent.
+		 * \returns        false if the connection has failed.
+		 */
+		bool sendFile(int fd, off_t &offset, off_t end);
+
+		/*!
+		 * Append received data to the input buffer.
+		 */
+		void receive(const char *data, std::size_t size);
+
+		/*!
+		 * Take the next complete message from the input buffer. Messages
+		 * are framed like the ones sent to the client: a 4 byte big endian
+		 * length followed by the MsgPack data.
+		 *
+		 * \param message   Output: the message without its length prefix.
+		 * \returns         false if no complete message is available.
+		 */
+		bool nextMessage(std::string &message);
+
+		std::size_t getQueuedBytes(void) const { return m_queuedBytes; }
+		uint64_t getDroppedFrames(void) const { return m_droppedFrames; }
+		uint64_t getResyncCount(void) const { return m_resyncCount; }
+		const std::string& getPeer(void) const { return m_peer; }
+
+		/*!
+		 * The settings the updates are selected by. Compression is not
+		 * applied from here, see setCompression().
+		 */
+		const ClientSettings& getSettings(void) const { return m_settings; }
+		void setSettings(const ClientSettings &settings) { m_settings = settings; }
+};
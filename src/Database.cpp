@@ -16,6 +16,8 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+
 #include "Database.h"
 #include <cppconn/exception.h>
 #include <cppconn/resultset.h>
@@ -23,24 +25,30 @@
 
 using namespace db;
 
+static const char* BOT_DATA_QUERY =
+	"SELECT u.id, u.username, sv.id, sv.code, IFNULL(p.viewer_key, 0) AS viewer_key "
+	"FROM core_userprofile p "
+	"LEFT JOIN auth_user u ON (u.id=p.user_id) "
+	"LEFT JOIN core_snakeversion sv ON (sv.id=p.active_snake_id) "
+	"WHERE p.active_snake_id IS NOT NULL AND ";
+
 void MysqlDatabase::Connect(std::string host, std::string username, std::string password, std::string database)
 {
 	_driver = get_driver_instance();
 	_connection = std::unique_ptr<sql::Connection>(_driver->connect(host, username, password));
 	_connection->setSchema(database);
 
-	_getBotDataStmt = makePreparedStatement(
-		"SELECT u.id, u.username, sv.id, sv.code, IFNULL(p.viewer_key, 0) AS viewer_key "
-		"FROM core_userprofile p "
-		"LEFT JOIN auth_user u ON (u.id=p.user_id) "
-		"LEFT JOIN core_snakeversion sv ON (sv.id=p.active_snake_id) "
-		"WHERE p.user_id=? AND p.active_snake_id IS NOT NULL"
-	);
+	_getBotDataStmt = makePreparedStatement(std::string(BOT_DATA_QUERY) + "p.user_id=?");
 
 	_getActiveBotIdsStmt = makePreparedStatement(
 		"SELECT user_id FROM core_userprofile WHERE active_snake_id IS NOT NULL"
 	);
 
+	_getActiveBotsChecksumStmt = makePreparedStatement(
+		"SELECT COUNT(*), IFNULL(SUM(user_id), 0), IFNULL(BIT_XOR(CRC32(user_id)), 0) "
+		"FROM core_userprofile WHERE active_snake_id IS NOT NULL"
+	);
+
 	_getActiveCommandsStmt = makePreparedStatement(
 		"SELECT id, user_id, command FROM core_servercommand WHERE ISNULL(result) ORDER BY dt_created"
 	);
@@ -85,6 +93,43 @@ std::unique_ptr<BotScript> MysqlDatabase::GetBotData(int bot_id)
 	);
 }
 
+std::vector< std::unique_ptr<BotScript> > MysqlDatabase::GetBotDataBatch(const std::vector<int> &bot_ids)
+{
+	std::vector< std::unique_ptr<BotScript> > retval;
+
+	for (std::size_t start=0; start<bot_ids.size(); start+=BOT_DATA_BATCH_SIZE)
+	{
+		std::size_t end = std::min(start + static_cast<std::size_t>(BOT_DATA_BATCH_SIZE), bot_ids.size());
+
+		std::string sql = std::string(BOT_DATA_QUERY) + "p.user_id IN (";
+		for (std::size_t i=start; i<end; i++)
+		{
+			sql += (i==start) ? "?" : ", ?";
+		}
+		sql += ")";
+
+		auto stmt = makePreparedStatement(sql);
+		for (std::size_t i=start; i<end; i++)
+		{
+			stmt->setInt(static_cast<uint32_t>(i - start + 1), bot_ids[i]);
+		}
+
+		std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+		while (res->next())
+		{
+			retval.push_back(std::make_unique<BotScript>(
+				res->getInt(IDX_BOTSCRIPT_BOT_ID),
+				res->getString(IDX_BOTSCRIPT_BOT_NAME),
+				res->getInt(IDX_BOTSCRIPT_VERSION_ID),
+				res->getInt64(IDX_BOTSCRIPT_VIEWER_KEY),
+				res->getString(IDX_BOTSCRIPT_CODE)
+			));
+		}
+	}
+
+	return retval;
+}
+
 std::vector<int> MysqlDatabase::GetActiveBotIds()
 {
 	std::unique_ptr<sql::ResultSet> res(_getActiveBotIdsStmt->executeQuery());
@@ -96,6 +141,20 @@ std::vector<int> MysqlDatabase::GetActiveBotIds()
 	return retval;
 }
 
+uint64_t MysqlDatabase::GetActiveBotsChecksum()
+{
+	std::unique_ptr<sql::ResultSet> res(_getActiveBotsChecksumStmt->executeQuery());
+	if (!res->next())
+	{
+		return 0;
+	}
+
+	uint64_t count = res->getUInt64(1);
+	uint64_t sum = res->getUInt64(2);
+	uint64_t crcs = res->getUInt64(3);
+	return (crcs << 32) ^ (sum * 0x9E3779B97F4A7C15ull) ^ count;
+}
+
 std::vector<Command> MysqlDatabase::GetActiveCommands()
 {
 	std::unique_ptr<sql::ResultSet> res(_getActiveCommandsStmt->executeQuery());
@@ -130,6 +189,44 @@ void MysqlDatabase::ReportBotKilled(long victim_id, long version_id, long start_
 	_reportBotKilledStmt->execute();
 }
 
+void MysqlDatabase::ReportBotsKilled(const std::vector<KillReport> &reports)
+{
+	if (reports.empty())
+	{
+		return;
+	}
+
+	// one multi-row insert per batch
+	std::string sql =
+		"INSERT INTO core_snakegame "
+		" (user_id, snake_version_id, start_frame, end_frame, killer_id, final_mass, natural_food_consumed, carrison_food_consumed, hunted_food_consumed, end_date) "
+		"VALUES ";
+
+	for (std::size_t i=0; i<reports.size(); i++)
+	{
+		sql += (i==0) ? " " : ", ";
+		sql += "(?, ?, ?, ?, ?, ?, ?, ?, ?, UTC_TIMESTAMP())";
+	}
+
+	auto stmt = makePreparedStatement(sql);
+
+	unsigned idx = 1;
+	for (auto &report: reports)
+	{
+		stmt->setInt64(idx++, report.victim_id);
+		stmt->setInt64(idx++, report.version_id);
+		stmt->setInt64(idx++, report.start_frame);
+		stmt->setInt64(idx++, report.end_frame);
+		if (report.killer_id<0) { stmt->setNull(idx++, 0); } else { stmt->setInt64(idx++, report.killer_id); }
+		stmt->setDouble(idx++, report.final_mass);
+		stmt->setDouble(idx++, report.natural_food_consumed);
+		stmt->setDouble(idx++, report.carrison_food_consumed);
+		stmt->setDouble(idx++, report.hunted_food_consumed);
+	}
+
+	stmt->execute();
+}
+
 void MysqlDatabase::DisableBotVersion(long version_id, std::string errorMessage)
 {
 	_disableBotVersionStmt->setInt64(1, version_id);
@@ -17,6 +17,8 @@
  */
 
 #pragma once
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 #include <memory>
@@ -55,30 +57,76 @@ namespace db
 			{}
 	};
 
+	/*!
+	 * Result of a game of a bot, as stored in core_snakegame.
+	 */
+	struct KillReport
+	{
+		long victim_id;
+		long version_id;
+		long start_frame;
+		long end_frame;
+		long killer_id; // -1 if the bot died without a killer
+		double final_mass;
+		double natural_food_consumed;
+		double carrison_food_consumed;
+		double hunted_food_consumed;
+	};
+
+	struct CommandResult
+	{
+		long command_id;
+		bool result;
+		std::string result_msg;
+	};
+
 	class IDatabase
 	{
 		public:
 			virtual ~IDatabase() = default;
 			virtual std::unique_ptr<BotScript> GetBotData(int bot_id) = 0;
+
+			/*!
+			 * Like GetBotData(), for many bots with few queries. Bots without
+			 * an active script are left out.
+			 */
+			virtual std::vector< std::unique_ptr<BotScript> > GetBotDataBatch(const std::vector<int> &bot_ids) = 0;
 			virtual std::vector<int> GetActiveBotIds() = 0;
+
+			/*!
+			 * \returns   A value that changes whenever the set of active bots
+			 *            changes, without transferring the set.
+			 */
+			virtual uint64_t GetActiveBotsChecksum() = 0;
 			virtual std::vector<Command> GetActiveCommands() = 0;
 			virtual void SetCommandCompleted(long commandId, bool result, std::string resultMsg) = 0;
 			virtual void ReportBotKilled(long victim_id, long version_id, long start_frame, long end_frame, long killer_id, double final_mass, double natural_food_consumed, double carrison_food_consumed, double hunted_food_consumed) = 0;
+			virtual void ReportBotsKilled(const std::vector<KillReport> &reports) = 0;
 			virtual void DisableBotVersion(long version_id, std::string errorMessage) = 0;
 	};
 
+	/*!
+	 * Creates a new database connection, e.g. for a background thread.
+	 */
+	typedef std::function<std::unique_ptr<IDatabase>(void)> ConnectFunction;
+
 	class MysqlDatabase : public IDatabase
 	{
 		public:
 			void Connect(std::string host, std::string username, std::string password, std::string database);
 			std::unique_ptr<BotScript> GetBotData(int bot_id) override;
+			std::vector< std::unique_ptr<BotScript> > GetBotDataBatch(const std::vector<int> &bot_ids) override;
 			std::vector<int> GetActiveBotIds() override;
+			uint64_t GetActiveBotsChecksum() override;
 			std::vector<Command> GetActiveCommands() override;
 			void SetCommandCompleted(long commandId, bool result, std::string resultMsg) override;
 			void ReportBotKilled(long victim_id, long version_id, long start_frame, long end_frame, long killer_id, double final_mass, double natural_food_consumed, double carrison_food_consumed, double hunted_food_consumed) override;
+			void ReportBotsKilled(const std::vector<KillReport> &reports) override;
 			void DisableBotVersion(long version_id, std::string errorMessage) override;
 
 		private:
+			static constexpr const std::size_t BOT_DATA_BATCH_SIZE = 500;
+
 			enum {
 				IDX_BOTSCRIPT_BOT_ID = 1,
 				IDX_BOTSCRIPT_BOT_NAME = 2,
@@ -91,6 +139,7 @@ namespace db
 			std::unique_ptr<sql::Connection> _connection;
 			std::unique_ptr<sql::PreparedStatement> _getBotDataStmt;
 			std::unique_ptr<sql::PreparedStatement> _getActiveBotIdsStmt;
+			std::unique_ptr<sql::PreparedStatement> _getActiveBotsChecksumStmt;
 			std::unique_ptr<sql::PreparedStatement> _getActiveCommandsStmt;
 			std::unique_ptr<sql::PreparedStatement> _commandCompletedStmt;
 			std::unique_ptr<sql::PreparedStatement> _reportBotKilledStmt;
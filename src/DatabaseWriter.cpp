@@ -0,0 +1,187 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include "DatabaseWriter.h"
+
+using namespace db;
+
+DatabaseWriter::DatabaseWriter(ConnectFunction connect)
+	: m_connect(connect)
+{
+	m_thread = std::thread([this]() { run(); });
+}
+
+DatabaseWriter::~DatabaseWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	m_recordsAvailable.notify_one();
+	m_thread.join();
+}
+
+bool DatabaseWriter::isFull(void) const
+{
+	if (m_killReports.size() + m_commandResults.size() < MAX_QUEUED_RECORDS)
+	{
+		return false;
+	}
+
+	if (m_droppedRecords == 0)
+	{
+		std::cerr << "database writer queue is full, dropping records" << std::endl;
+	}
+	return true;
+}
+
+void DatabaseWriter::ReportBotKilled(const KillReport &report)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (isFull())
+		{
+			m_droppedRecords++;
+			return;
+		}
+		m_killReports.push_back(report);
+	}
+	m_recordsAvailable.notify_one();
+}
+
+void DatabaseWriter::SetCommandCompleted(long commandId, bool result, std::string resultMsg)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (isFull())
+		{
+			m_droppedRecords++;
+			return;
+		}
+		m_commandResults.push_back({commandId, result, std::move(resultMsg)});
+	}
+	m_recordsAvailable.notify_one();
+}
+
+void DatabaseWriter::run(void)
+{
+	std::vector<KillReport> killReports;
+	std::vector<CommandResult> commandResults;
+	int retryDelay = INITIAL_RETRY_DELAY_MS;
+
+	while (true)
+	{
+		bool shutdown;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			if (killReports.empty() && commandResults.empty())
+			{
+				m_recordsAvailable.wait(lock, [this]() {
+					return m_shutdown || !m_killReports.empty() || !m_commandResults.empty();
+				});
+
+				// take everything at once, so it is written in few statements
+				killReports.swap(m_killReports);
+				commandResults.swap(m_commandResults);
+			}
+			else
+			{
+				// failed records are retried before new ones are taken
+				m_recordsAvailable.wait_for(lock, std::chrono::milliseconds(retryDelay),
+						[this]() { return m_shutdown; });
+
+				if (m_shutdown)
+				{
+					killReports.insert(killReports.end(), m_killReports.begin(), m_killReports.end());
+					commandResults.insert(commandResults.end(), m_commandResults.begin(), m_commandResults.end());
+					m_killReports.clear();
+					m_commandResults.clear();
+				}
+			}
+
+			if (m_droppedRecords > 0)
+			{
+				std::cerr << m_droppedRecords << " database records were dropped" << std::endl;
+				m_droppedRecords = 0;
+			}
+
+			shutdown = m_shutdown;
+		}
+
+		if (killReports.empty() && commandResults.empty() && shutdown)
+		{
+			return;
+		}
+
+		if (write(killReports, commandResults))
+		{
+			retryDelay = INITIAL_RETRY_DELAY_MS;
+		}
+		else if (shutdown)
+		{
+			std::cerr << "lost " << (killReports.size() + commandResults.size())
+				<< " database records on shutdown" << std::endl;
+			return;
+		}
+		else
+		{
+			retryDelay = (2*retryDelay < MAX_RETRY_DELAY_MS) ? 2*retryDelay : MAX_RETRY_DELAY_MS;
+		}
+	}
+}
+
+bool DatabaseWriter::write(std::vector<KillReport> &killReports, std::vector<CommandResult> &commandResults)
+{
+	try
+	{
+		if (!m_database)
+		{
+			m_database = m_connect();
+		}
+
+		// written records are removed, so a retry continues where it failed
+		while (!killReports.empty())
+		{
+			std::size_t count = (killReports.size() < MAX_BATCH_SIZE) ? killReports.size() : MAX_BATCH_SIZE;
+			std::vector<KillReport> batch(killReports.begin(), killReports.begin() + count);
+			m_database->ReportBotsKilled(batch);
+			killReports.erase(killReports.begin(), killReports.begin() + count);
+		}
+
+		while (!commandResults.empty())
+		{
+			auto &cmd = commandResults.front();
+			m_database->SetCommandCompleted(cmd.command_id, cmd.result, cmd.result_msg);
+			commandResults.erase(commandResults.begin());
+		}
+
+		return true;
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << "database write failed: " << e.what() << std::endl;
+
+		// reconnect on the next try
+		m_database = nullptr;
+		return false;
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Database.h"
+
+namespace db
+{
+	/*!
+	 * \brief Writes game results to the database on a background thread.
+	 *
+	 * The game thread only appends small records to a bounded queue. The
+	 * writer takes everything queued at once, inserts the kill reports with
+	 * multi-row statements and retries with a growing delay (and a new
+	 * connection) if the database fails. If the queue is full, new records
+	 * are dropped instead of blocking the game.
+	 */
+	class DatabaseWriter
+	{
+		public:
+			/*!
+			 * \param connect   Creates a connection for the writer thread; it
+			 *                  is called again after an error.
+			 */
+			DatabaseWriter(ConnectFunction connect);
+
+			/*!
+			 * Writes all queued records (without retrying) and stops the
+			 * thread.
+			 */
+			~DatabaseWriter();
+
+			DatabaseWriter(const DatabaseWriter&) = delete;
+			DatabaseWriter& operator=(const DatabaseWriter&) = delete;
+
+			void ReportBotKilled(const KillReport &report);
+			void SetCommandCompleted(long commandId, bool result, std::string resultMsg);
+
+		private:
+			static constexpr const std::size_t MAX_QUEUED_RECORDS = 10000;
+			static constexpr const std::size_t MAX_BATCH_SIZE = 100;
+			static constexpr const int INITIAL_RETRY_DELAY_MS = 500;
+			static constexpr const int MAX_RETRY_DELAY_MS = 30000;
+
+			ConnectFunction m_connect;
+
+			std::mutex m_mutex;
+			std::condition_variable m_recordsAvailable;
+			std::vector<KillReport> m_killReports;
+			std::vector<CommandResult> m_commandResults;
+			std::size_t m_droppedRecords = 0;
+			bool m_shutdown = false;
+
+			// only used by the writer thread
+			std::unique_ptr<IDatabase> m_database;
+
+			std::thread m_thread;
+
+			bool isFull(void) const;
+			void run(void);
+			bool write(std::vector<KillReport> &killReports, std::vector<CommandResult> &commandResults);
+	};
+}
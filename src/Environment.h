@@ -22,6 +22,10 @@
 class Environment
 {
 	public:
+		// "mysql" or "sqlite"
+		static constexpr const char* ENV_DATABASE_BACKEND = "DATABASE_BACKEND";
+		static constexpr const char* ENV_DATABASE_BACKEND_DEFAULT = "mysql";
+
 		static constexpr const char* ENV_MYSQL_HOST = "MYSQL_HOST";
 		static constexpr const char* ENV_MYSQL_HOST_DEFAULT = "localhost";
 
@@ -34,6 +38,34 @@ class Environment
 		static constexpr const char* ENV_MYSQL_DB = "MYSQL_DB";
 		static constexpr const char* ENV_MYSQL_DB_DEFAULT = "gameserver";
 
+		static constexpr const char* ENV_SQLITE_DB = "SQLITE_DB";
+		static constexpr const char* ENV_SQLITE_DB_DEFAULT = "gameserver.sqlite";
+
+		// if set, all *.lua files in this directory are registered as bots
+		// in the SQLite database on startup, each SQLITE_BOT_COPIES times
+		static constexpr const char* ENV_SQLITE_BOT_DIR = "SQLITE_BOT_DIR";
+		static constexpr const char* ENV_SQLITE_BOT_DIR_DEFAULT = "";
+		static constexpr const char* ENV_SQLITE_BOT_COPIES = "SQLITE_BOT_COPIES";
+		static constexpr const char* ENV_SQLITE_BOT_COPIES_DEFAULT = "1";
+
+		// file from which the game is resumed and to which it is saved
+		// periodically, disabled if empty
+		static constexpr const char* ENV_CHECKPOINT_FILE = "CHECKPOINT_FILE";
+		static constexpr const char* ENV_CHECKPOINT_FILE_DEFAULT = "";
+
+		// if set, the game is recorded to this file and an index next to it
+		static constexpr const char* ENV_RECORDING_FILE = "RECORDING_FILE";
+		static constexpr const char* ENV_RECORDING_FILE_DEFAULT = "";
+
+		// if set, the update stream is archived in this directory, from
+		// which viewers can replay past frames
+		static constexpr const char* ENV_ARCHIVE_DIR = "ARCHIVE_DIR";
+		static constexpr const char* ENV_ARCHIVE_DIR_DEFAULT = "";
+
+		// path of a zstd dictionary for compressed streams, none if empty
+		static constexpr const char* ENV_COMPRESSION_DICTIONARY = "COMPRESSION_DICTIONARY";
+		static constexpr const char* ENV_COMPRESSION_DICTIONARY_DEFAULT = "";
+
 		static const char* GetDefault(const char* env, const char* defaultValue)
 		{
 			const char* value = std::getenv(env);
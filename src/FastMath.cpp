@@ -0,0 +1,132 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "FastMath.h"
+
+namespace {
+
+	typedef real_t  vreal_t __attribute__((vector_size(4*sizeof(real_t))));
+	typedef int32_t vmask_t __attribute__((vector_size(4*sizeof(real_t))));
+	static const std::size_t LANES = sizeof(vreal_t) / sizeof(real_t);
+
+	static const real_t PI      = static_cast<real_t>(M_PI);
+	static const real_t HALF_PI = static_cast<real_t>(M_PI/2);
+	static const real_t TWO_PI  = static_cast<real_t>(2*M_PI);
+
+	// minimax polynomial for atan(a), a in [0, 1] (odd powers a^1 .. a^11)
+	static const real_t C1  =  0.99997726f;
+	static const real_t C3  = -0.33262347f;
+	static const real_t C5  =  0.19354346f;
+	static const real_t C7  = -0.11643287f;
+	static const real_t C9  =  0.05265332f;
+	static const real_t C11 = -0.01172120f;
+
+	/*!
+	 * Shared implementation for scalars and vectors. All branches are
+	 * expressed as selects, so the vector version runs without branching.
+	 */
+	template <class V, class Select> inline V atan2Impl(V y, V x, Select select)
+	{
+		V ax = select(x < 0, -x, x);
+		V ay = select(y < 0, -y, y);
+
+		V maxXY = select(ax > ay, ax, ay);
+		V minXY = select(ax > ay, ay, ax);
+
+		// avoid 0/0 for (0, 0); minXY is 0 in that case, too
+		V a = minXY / select(maxXY > 0, maxXY, maxXY + 1);
+		V s = a * a;
+
+		V r = a * (C1 + s*(C3 + s*(C5 + s*(C7 + s*(C9 + s*C11)))));
+
+		r = select(ay > ax, HALF_PI - r, r);
+		r = select(x < 0, PI - r, r);
+		r = select(y < 0, -r, r);
+		return r;
+	}
+
+	template <class V, class Select> inline V normalizeAngle(V angle, Select select)
+	{
+		angle = select(angle > PI, angle - TWO_PI, angle);
+		angle = select(angle < -PI, angle + TWO_PI, angle);
+		return angle;
+	}
+
+	inline real_t selectScalar(bool condition, real_t a, real_t b)
+	{
+		return condition ? a : b;
+	}
+
+	inline vreal_t selectVector(vmask_t condition, vreal_t a, vreal_t b)
+	{
+		return condition ? a : b;
+	}
+}
+
+real_t fastmath::atan2(real_t y, real_t x)
+{
+	return atan2Impl(y, x, selectScalar);
+}
+
+static inline void polarBlock(const real_t *x, const real_t *y, real_t heading,
+		real_t *distance, real_t *direction)
+{
+	vreal_t vx, vy;
+	std::memcpy(&vx, x, sizeof(vx));
+	std::memcpy(&vy, y, sizeof(vy));
+
+	vreal_t vdir = atan2Impl(vy, vx, selectVector) - heading;
+	vdir = normalizeAngle(vdir, selectVector);
+
+	vreal_t vdist = vx*vx + vy*vy;
+	for (std::size_t lane = 0; lane < LANES; lane++)
+	{
+		vdist[lane] = __builtin_sqrtf(vdist[lane]); // argument is never negative
+	}
+
+	std::memcpy(direction, &vdir, sizeof(vdir));
+	std::memcpy(distance, &vdist, sizeof(vdist));
+}
+
+void fastmath::polarCoordinates(const real_t *x, const real_t *y, std::size_t count,
+		real_t heading, real_t *distance, real_t *direction)
+{
+	std::size_t i = 0;
+	for (; i + LANES <= count; i += LANES)
+	{
+		polarBlock(x + i, y + i, heading, distance + i, direction + i);
+	}
+
+	// remaining elements: pad to a full block
+	if (i < count)
+	{
+		real_t tx[LANES] = {}, ty[LANES] = {}, tdist[LANES], tdir[LANES];
+		std::copy(x + i, x + count, tx);
+		std::copy(y + i, y + count, ty);
+
+		polarBlock(tx, ty, heading, tdist, tdir);
+
+		std::copy(tdist, tdist + (count - i), distance + i);
+		std::copy(tdir, tdir + (count - i), direction + i);
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file
+ *
+ * \brief Approximated math functions for batches of values.
+ */
+#pragma once
+
+#include <cstddef>
+
+#include "types.h"
+
+namespace fastmath {
+
+	/*!
+	 * Maximum absolute error (in radians) of atan2() and of the directions
+	 * calculated by polarCoordinates(), compared to std::atan2 in double
+	 * precision. About 2e-6 is measured (polynomial error plus single
+	 * precision rounding), which is far below anything a bot can steer.
+	 * Verified by test/bench_fastmath.cpp.
+	 */
+	static constexpr const real_t ATAN2_MAX_ERROR = 3e-6;
+
+	/*!
+	 * Polynomial approximation of std::atan2.
+	 *
+	 * \returns   The angle of (x, y) in [-pi, pi]; 0 for (0, 0).
+	 */
+	real_t atan2(real_t y, real_t x);
+
+	/*!
+	 * Convert a batch of positions relative to a bot's head into distance and
+	 * direction relative to its heading.
+	 *
+	 * This processes four positions at a time using SIMD instructions (via the
+	 * compiler's vector extensions).
+	 *
+	 * \param x           Relative x coordinates.
+	 * \param y           Relative y coordinates.
+	 * \param count       Number of positions.
+	 * \param heading     The heading of the bot in radians.
+	 * \param distance    Output: length of each position vector.
+	 * \param direction   Output: angle of each position relative to heading,
+	 *                    normalized to [-pi, pi].
+	 */
+	void polarCoordinates(const real_t *x, const real_t *y, std::size_t count,
+			real_t heading, real_t *distance, real_t *direction);
+}
@@ -17,6 +17,8 @@
  */
 
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <vector>
 #include <algorithm>
 
@@ -28,6 +30,8 @@ Field::Field(real_t w, real_t h, std::size_t food_parts, std::unique_ptr<UpdateT
 	, m_updateTracker(std::move(update_tracker))
 	, m_foodMap(static_cast<size_t>(w), static_cast<size_t>(h), config::SPATIAL_MAP_RESERVE_COUNT)
 	, m_segmentInfoMap(static_cast<size_t>(w), static_cast<size_t>(h), config::SPATIAL_MAP_RESERVE_COUNT)
+	, m_foodQueryMap(w, h)
+	, m_segmentQueryMap(w, h)
 	, m_threadPool(std::thread::hardware_concurrency())
 {
 	setupRandomness();
@@ -93,7 +97,28 @@ void Field::updateMaxSegmentRadius(void)
 	}
 }
 
-std::shared_ptr<Bot> Field::newBot(std::unique_ptr<db::BotScript> data, std::string& initErrorMessage)
+void Field::updateQueryMaps(void)
+{
+	m_foodQueryMap.clear();
+	for (auto &food: m_foodMap)
+	{
+		m_foodQueryMap.addElement({food.pos().x(), food.pos().y(), food.getValue()});
+	}
+	m_foodQueryMap.finalize();
+
+	m_segmentQueryMap.clear();
+	for (auto &b: m_bots)
+	{
+		real_t radius = b->getSnake()->getSegmentRadius();
+		for (auto &s: b->getSnake()->getSegments())
+		{
+			m_segmentQueryMap.addElement({s.pos().x(), s.pos().y(), radius, b.get()});
+		}
+	}
+	m_segmentQueryMap.finalize();
+}
+
+std::shared_ptr<Bot> Field::createBot(std::unique_ptr<db::BotScript> data)
 {
 	real_t x = (*m_positionXDistribution)(*m_rndGen);
 	real_t y = (*m_positionYDistribution)(*m_rndGen);
@@ -108,19 +133,161 @@ std::shared_ptr<Bot> Field::newBot(std::unique_ptr<db::BotScript> data, std::str
 	);
 
 	std::cerr << "Initializing Bot with ID " << bot->getGUID() << ", DB-ID " << bot->getDatabaseId() << ", Name: " << bot->getName() << std::endl;
+	return bot;
+}
+
+std::shared_ptr<Bot> Field::newBot(std::unique_ptr<db::BotScript> data, std::string& initErrorMessage)
+{
+	auto bot = createBot(std::move(data));
 
 	initErrorMessage = "";
-	if (bot->init(initErrorMessage))
+	bool initSuccessful = bot->init(initErrorMessage);
+
+	addBot(bot, initSuccessful, initErrorMessage);
+	return bot;
+}
+
+std::vector< std::shared_ptr<Bot> > Field::newBots(
+		std::vector< std::unique_ptr<db::BotScript> > data,
+		std::vector<std::string> &initErrorMessages)
+{
+	std::vector< std::shared_ptr<Bot> > bots;
+	for (auto &botData: data)
+	{
+		bots.push_back(createBot(std::move(botData)));
+	}
+
+	initBots(bots, initErrorMessages);
+	return bots;
+}
+
+void Field::initBots(const std::vector< std::shared_ptr<Bot> > &bots, std::vector<std::string> &initErrorMessages)
+{
+	for (auto &bot: bots)
+	{
+		std::unique_ptr<BotThreadPool::Job> job(new BotThreadPool::Job(BotThreadPool::Init, bot));
+		m_threadPool.addJob(std::move(job));
+	}
+
+	m_threadPool.waitForCompletion();
+
+	std::map<Bot*, std::unique_ptr<BotThreadPool::Job>> results;
+	std::unique_ptr<BotThreadPool::Job> job;
+	while((job = m_threadPool.getProcessedJob()) != NULL) {
+		Bot *bot = job->bot.get();
+		results[bot] = std::move(job);
+	}
+
+	// in the original order, so the result does not depend on the threads
+	initErrorMessages.clear();
+	for (auto &bot: bots)
+	{
+		auto &result = results[bot.get()];
+		addBot(bot, result->initSuccessful, result->initErrorMessage);
+		initErrorMessages.push_back(result->initErrorMessage);
+	}
+}
+
+void Field::saveSnapshot(FieldSnapshot &snapshot)
+{
+	snapshot.frame = m_currentFrame;
+	snapshot.fieldWidth = m_width;
+	snapshot.fieldHeight = m_height;
+
+	snapshot.food.clear();
+	for (auto &food: m_foodMap)
+	{
+		auto hunter = food.getHunter();
+		snapshot.food.push_back({
+			food.pos().x(), food.pos().y(),
+			food.getValue(),
+			hunter ? hunter->getDatabaseId() : -1,
+			food.shallRegenerate()
+		});
+	}
+
+	snapshot.bots.resize(m_bots.size());
+	snapshot.botInfo.resize(m_bots.size());
+	snapshot.segments.clear();
+	std::size_t i = 0;
+	for (auto &bot: m_bots)
+	{
+		bot->saveState(snapshot.bots[i], snapshot.segments);
+		snapshot.botInfo[i].guid = bot->getGUID();
+		snapshot.botInfo[i].name = bot->getName();
+		i++;
+	}
+
+	std::ostringstream randomState;
+	randomState << *m_rndGen << " " << *m_foodSizeDistribution;
+	snapshot.randomState = randomState.str();
+}
+
+std::vector< std::shared_ptr<Bot> > Field::restoreCheckpoint(
+		const MappedCheckpoint &checkpoint,
+		std::vector< std::unique_ptr<db::BotScript> > data,
+		std::vector<std::string> &initErrorMessages)
+{
+	auto botRecords = checkpoint.getBots();
+	auto segmentRecords = checkpoint.getSegments();
+
+	std::unordered_map<int, const Checkpoint::BotRecord*> recordsByDatabaseId;
+	for (auto &record: botRecords)
+	{
+		recordsByDatabaseId[record.databaseId] = &record;
+	}
+
+	std::vector< std::shared_ptr<Bot> > bots;
+	for (auto &botData: data)
+	{
+		auto it = recordsByDatabaseId.find(botData->bot_id);
+		if (it == recordsByDatabaseId.end())
+		{
+			continue;
+		}
+
+		auto bot = createBot(std::move(botData));
+		bot->restoreState(*it->second, segmentRecords.begin() + it->second->firstSegment);
+		bots.push_back(bot);
+	}
+
+	initBots(bots, initErrorMessages);
+
+	for (auto &record: checkpoint.getFood())
+	{
+		std::shared_ptr<Bot> hunter;
+		if (record.hunterDatabaseId >= 0)
+		{
+			hunter = getBotByDatabaseId(record.hunterDatabaseId);
+		}
+
+		Food food {record.shallRegenerate != 0, Vector2D(record.x, record.y), record.value, hunter};
+		m_updateTracker->foodSpawned(food);
+		m_foodMap.addElement(food);
+	}
+
+	// after creating the bots, which draws random numbers
+	std::istringstream randomState(checkpoint.getRandomState());
+	randomState >> *m_rndGen >> *m_foodSizeDistribution;
+
+	m_currentFrame = checkpoint.getHeader().frame;
+
+	return bots;
+}
+
+void Field::addBot(const std::shared_ptr<Bot> &bot, bool initSuccessful, const std::string &initErrorMessage)
+{
+	if (initSuccessful)
 	{
 		m_updateTracker->botLogMessage(bot->getViewerKey(), "starting bot");
 		m_updateTracker->botSpawned(bot);
 		m_bots.insert(bot);
+		m_botsByDatabaseId[bot->getDatabaseId()] = bot;
 	}
 	else
 	{
 		m_updateTracker->botLogMessage(bot->getViewerKey(), "cannot start bot: " + initErrorMessage);
 	}
-	return bot;
 }
 
 void Field::decayFood(void)
@@ -146,33 +313,76 @@ void Field::removeFood()
 
 void Field::consumeFood(void)
 {
-	size_t newStaticFood = 0;
+	// first round: find the reachable food of all bots; this only reads
+	// the food map
 	for (auto &b: m_bots) {
-		auto headPos = b->getSnake()->getHeadPosition();
-		auto radius = b->getSnake()->getSegmentRadius() * config::SNAKE_CONSUME_RANGE;
+		std::unique_ptr<BotThreadPool::Job> job(new BotThreadPool::Job(BotThreadPool::FindFood, b));
+		m_threadPool.addJob(std::move(job));
+	}
+
+	m_threadPool.waitForCompletion();
+
+	std::vector< std::unique_ptr<BotThreadPool::Job> > jobs;
+	jobs.reserve(m_bots.size());
+
+	std::unique_ptr<BotThreadPool::Job> job;
+	while((job = m_threadPool.getProcessedJob()) != NULL) {
+		jobs.push_back(std::move(job));
+	}
 
-		for (auto& fi: m_foodMap.getRegion(headPos, radius))
+	// second round: food within reach of several bots goes to the one with
+	// the lowest GUID, independent of the order the jobs finished in
+	std::sort(jobs.begin(), jobs.end(),
+		[](const std::unique_ptr<BotThreadPool::Job> &a, const std::unique_ptr<BotThreadPool::Job> &b) {
+			return a->bot->getGUID() < b->bot->getGUID();
+		});
+
+	size_t newStaticFood = 0;
+	for (auto &j: jobs) {
+		auto claimed = j->food.begin();
+
+		for (Food *fi: j->food)
 		{
-			if (b->getSnake()->tryConsume(fi))
+			if (fi->shallBeRemoved())
 			{
-				b->updateConsumeStats(fi);
-				m_updateTracker->foodConsumed(fi, b);
-				fi.markForRemove();
-				if (fi.shallRegenerate())
-				{
-					newStaticFood++;
-				}
+				continue; // claimed by a bot with a lower GUID
 			}
+
+			fi->markForRemove();
+			if (fi->shallRegenerate())
+			{
+				newStaticFood++;
+			}
+			*claimed++ = fi;
 		}
 
-		b->getSnake()->ensureSizeMatchesMass();
+		j->food.erase(claimed, j->food.end());
+	}
+
+	// third round: all bots consume their food in parallel; the tracker
+	// merges the events by bot GUID, so they are in the same order as above
+	for (auto &j: jobs) {
+		j->jobType = BotThreadPool::ConsumeFood;
+		m_threadPool.addJob(std::move(j));
+	}
+
+	m_threadPool.waitForCompletion();
+
+	while((job = m_threadPool.getProcessedJob()) != NULL) {
+		// nothing to do
 	}
+
+	m_updateTracker->mergeEventBuffers();
+
 	createStaticFood(newStaticFood);
 	updateMaxSegmentRadius();
 }
 
 void Field::moveAllBots(void)
 {
+	// the bots query these while moving
+	updateQueryMaps();
+
 	// first round: move all bots
 	for(auto &b : m_bots) {
 		std::unique_ptr<BotThreadPool::Job> job(new BotThreadPool::Job(BotThreadPool::Move, b));
@@ -190,6 +400,23 @@ void Field::moveAllBots(void)
 		tmpJobs.push_back(std::move(job));
 	}
 
+	if (m_recordBotInputs) {
+		m_botInputs.clear();
+		for (auto &j : tmpJobs) {
+			m_botInputs.push_back({
+				j->bot->getGUID(),
+				j->bot->getDatabaseId(),
+				j->bot->getLastDirectionChange(),
+				j->bot->getLastBoost(),
+				0
+			});
+		}
+
+		// the jobs finish in any order
+		std::sort(m_botInputs.begin(), m_botInputs.end(),
+			[](const Recording::BotInput &a, const Recording::BotInput &b) { return a.guid < b.guid; });
+	}
+
 	// second round: collision check
 	for(auto &j : tmpJobs) {
 		j->jobType = BotThreadPool::CollisionCheck;
@@ -273,14 +500,8 @@ const Field::BotSet& Field::getBots(void) const
 
 std::shared_ptr<Bot> Field::getBotByDatabaseId(int id)
 {
-	for (auto& bot: m_bots)
-	{
-		if (bot->getDatabaseId() == id)
-		{
-			return bot;
-		}
-	}
-	return nullptr;
+	auto it = m_botsByDatabaseId.find(id);
+	return (it != m_botsByDatabaseId.end()) ? it->second : nullptr;
 }
 
 void Field::createDynamicFood(real_t totalValue, const Vector2D &center, real_t radius,
@@ -429,6 +650,12 @@ void Field::killBot(std::shared_ptr<Bot> victim, std::shared_ptr<Bot> killer)
 {
 	victim->getSnake()->convertToFood(killer);
 	m_bots.erase(victim);
+
+	auto byId = m_botsByDatabaseId.find(victim->getDatabaseId());
+	if ((byId != m_botsByDatabaseId.end()) && (byId->second == victim))
+	{
+		m_botsByDatabaseId.erase(byId);
+	}
 	m_updateTracker->botKilled(killer, victim);
 
 	// bot will eventually be recreated in callbacks
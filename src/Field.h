@@ -20,8 +20,12 @@
 
 #include <set>
 #include <memory>
+#include <unordered_map>
 #include <random>
 
+#include "Checkpoint.h"
+#include "FieldSnapshot.h"
+#include "Recording.h"
 #include "Database.h"
 #include "types.h"
 #include "config.h"
@@ -29,6 +33,7 @@
 #include "Bot.h"
 #include "UpdateTracker.h"
 #include "SpatialMap.h"
+#include "PackedSpatialMap.h"
 #include "BotThreadPool.h"
 
 /*!
@@ -58,6 +63,25 @@ class Field
 
 		typedef SpatialMap<Food, config::SPATIAL_MAP_TILES_X, config::SPATIAL_MAP_TILES_Y> FoodMap;
 
+		/*!
+		 * Packed food item for the per-frame query map.
+		 */
+		struct FoodQueryItem {
+			real_t x, y;
+			real_t value;
+		};
+		typedef PackedSpatialMap<FoodQueryItem, config::SPATIAL_MAP_TILES_X, config::SPATIAL_MAP_TILES_Y> FoodQueryMap;
+
+		/*!
+		 * Packed snake segment for the per-frame query map.
+		 */
+		struct SegmentQueryItem {
+			real_t x, y;
+			real_t radius; //!< segment radius of the owning snake
+			Bot *bot;      //!< the bot this segment belongs to
+		};
+		typedef PackedSpatialMap<SegmentQueryItem, config::SPATIAL_MAP_TILES_X, config::SPATIAL_MAP_TILES_Y> SegmentQueryMap;
+
 	private:
 		const real_t m_width;
 		const real_t m_height;
@@ -65,6 +89,7 @@ class Field
 		uint32_t m_currentFrame = 0;
 
 		BotSet  m_bots;
+		std::unordered_map< int, std::shared_ptr<Bot> > m_botsByDatabaseId;
 
 		std::unique_ptr<std::mt19937> m_rndGen;
 
@@ -78,7 +103,11 @@ class Field
 
 		FoodMap m_foodMap;
 		SegmentInfoMap m_segmentInfoMap;
+		FoodQueryMap m_foodQueryMap;
+		SegmentQueryMap m_segmentQueryMap;
 		std::vector<BotKilledCallback> m_botKilledCallbacks;
+		bool m_recordBotInputs = false;
+		std::vector<Recording::BotInput> m_botInputs;
 		BotThreadPool m_threadPool;
 
 		void setupRandomness(void);
@@ -87,6 +116,21 @@ class Field
 		void updateSnakeSegmentMap(void);
 		void updateMaxSegmentRadius(void);
 
+		/*!
+		 * Rebuild the packed query maps used by the bots' Lua API from the
+		 * current food and bot state.
+		 */
+		void updateQueryMaps(void);
+
+		std::shared_ptr<Bot> createBot(std::unique_ptr<db::BotScript> data);
+		void addBot(const std::shared_ptr<Bot> &bot, bool initSuccessful, const std::string &initErrorMessage);
+
+		/*!
+		 * Initialize the bots in parallel on the thread pool and add them to
+		 * the field in their original order.
+		 */
+		void initBots(const std::vector< std::shared_ptr<Bot> > &bots, std::vector<std::string> &initErrorMessages);
+
 	public:
 		Field(real_t w, real_t h, std::size_t food_parts, std::unique_ptr<UpdateTracker> update_tracker);
 
@@ -96,6 +140,39 @@ class Field
 		 */
 		std::shared_ptr<Bot> newBot(std::unique_ptr<db::BotScript> data, std::string &initErrorMessage);
 
+		/*!
+		 * Create many bots at once. They are initialized in parallel on the
+		 * thread pool; only adding them to the field is serialized.
+		 *
+		 * @param initErrorMessages  Output: one entry per bot, non-empty if
+		 *                           its initialization failed
+		 * @return the new bots, in the order of data
+		 */
+		std::vector< std::shared_ptr<Bot> > newBots(
+				std::vector< std::unique_ptr<db::BotScript> > data,
+				std::vector<std::string> &initErrorMessages);
+
+		/*!
+		 * Copy the state of the field into the snapshot, reusing its memory.
+		 */
+		void saveSnapshot(FieldSnapshot &snapshot);
+
+		/*!
+		 * Continue the game from a checkpoint. Expects a field created without
+		 * static food.
+		 *
+		 * Bots are only restored if their script is given in data; the food
+		 * and the random generator are restored in any case.
+		 *
+		 * @param initErrorMessages  Output: one entry per restored bot,
+		 *                           non-empty if its initialization failed
+		 * @return the restored bots
+		 */
+		std::vector< std::shared_ptr<Bot> > restoreCheckpoint(
+				const MappedCheckpoint &checkpoint,
+				std::vector< std::unique_ptr<db::BotScript> > data,
+				std::vector<std::string> &initErrorMessages);
+
 		/*!
 		 * Decay all food.
 		 *
@@ -202,10 +279,28 @@ class Field
 		FoodMap& getFoodMap() { return m_foodMap; }
 		SegmentInfoMap& getSegmentInfoMap() { return m_segmentInfoMap; }
 
+		/*!
+		 * Read-only packed copies of the food and segment maps. They are
+		 * rebuilt once per frame before the bots are moved and may be queried
+		 * concurrently from the worker threads.
+		 */
+		const FoodQueryMap& getFoodQueryMap() const { return m_foodQueryMap; }
+		const SegmentQueryMap& getSegmentQueryMap() const { return m_segmentQueryMap; }
+
 		void addBotKilledCallback(BotKilledCallback callback);
 		void killBot(std::shared_ptr<Bot> victim, std::shared_ptr<Bot> killer);
 
 		UpdateTracker& getUpdateTracker() { return *m_updateTracker; }
 
+		/*!
+		 * Collect the steering decisions of all bots in moveAllBots().
+		 */
+		void setRecordBotInputs(bool enabled) { m_recordBotInputs = enabled; }
+
+		/*!
+		 * The steering decisions of the last moveAllBots(), ordered by GUID.
+		 */
+		const std::vector<Recording::BotInput>& getBotInputs(void) const { return m_botInputs; }
+
 		uint32_t getCurrentFrame() { return m_currentFrame; }
 };
@@ -0,0 +1,80 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "FieldSnapshot.h"
+
+std::shared_ptr<const FieldSnapshot> SnapshotPublisher::getLatest(void) const
+{
+	return std::atomic_load(&m_latest);
+}
+
+std::shared_ptr<const FieldSnapshot> SnapshotPublisher::waitForSnapshot(uint64_t newerThanEpoch, std::chrono::milliseconds timeout)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	auto isNewer = [this, newerThanEpoch]()
+	{
+		auto latest = getLatest();
+		return latest && (latest->epoch > newerThanEpoch);
+	};
+
+	if (!isNewer())
+	{
+		m_requested.store(true, std::memory_order_release);
+		if (!m_published.wait_for(lock, timeout, isNewer))
+		{
+			return nullptr;
+		}
+	}
+
+	return getLatest();
+}
+
+std::shared_ptr<FieldSnapshot> SnapshotPublisher::acquire(void)
+{
+	// a snapshot is free again when only the pool holds a reference
+	for (auto &snapshot: m_pool)
+	{
+		if (snapshot.use_count() == 1)
+		{
+			// the last reader may have dropped it on another thread; see its
+			// reads before overwriting
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return snapshot;
+		}
+	}
+
+	auto snapshot = std::make_shared<FieldSnapshot>();
+	if (m_pool.size() < POOL_SIZE)
+	{
+		m_pool.push_back(snapshot);
+	}
+	return snapshot;
+}
+
+void SnapshotPublisher::publish(std::shared_ptr<FieldSnapshot> snapshot)
+{
+	snapshot->epoch = ++m_epoch;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::atomic_store(&m_latest, std::shared_ptr<const FieldSnapshot>(std::move(snapshot)));
+		m_requested.store(false, std::memory_order_release);
+	}
+	m_published.notify_all();
+}
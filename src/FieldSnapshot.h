@@ -0,0 +1,102 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Checkpoint.h"
+#include "types.h"
+
+/*!
+ * \brief Immutable copy of the Field at the end of a frame.
+ *
+ * Contains the checkpoint state and information about the bots that is not
+ * saved in checkpoints.
+ */
+struct FieldSnapshot : public Checkpoint
+{
+	struct BotInfo
+	{
+		guid_t guid;
+		std::string name;
+	};
+
+	uint64_t epoch = 0; //!< increases with every published snapshot
+	std::vector<BotInfo> botInfo; //!< in the order of bots
+};
+
+/*!
+ * \brief Hands consistent views of the Field to other threads.
+ *
+ * The game thread only copies the field when a reader asked for a new
+ * snapshot, and at most once per frame. Published snapshots are never
+ * modified: readers keep using theirs while the next frames are simulated,
+ * and its memory is reused once all of them dropped it.
+ */
+class SnapshotPublisher
+{
+	private:
+		static constexpr const std::size_t POOL_SIZE = 4;
+
+		std::vector< std::shared_ptr<FieldSnapshot> > m_pool; // only used by the game thread
+		uint64_t m_epoch = 0;
+
+		std::shared_ptr<const FieldSnapshot> m_latest; // accessed atomically
+		std::atomic<bool> m_requested{false};
+
+		std::mutex m_mutex;
+		std::condition_variable m_published;
+
+	public:
+		/*!
+		 * Get the newest snapshot without waiting. It may be old, or
+		 * nullptr if none was requested yet.
+		 */
+		std::shared_ptr<const FieldSnapshot> getLatest(void) const;
+
+		/*!
+		 * Request a snapshot and wait until one newer than the given epoch is
+		 * published.
+		 *
+		 * \returns   The snapshot, or nullptr on timeout.
+		 */
+		std::shared_ptr<const FieldSnapshot> waitForSnapshot(uint64_t newerThanEpoch, std::chrono::milliseconds timeout);
+
+		/*!
+		 * For the game thread: whether a snapshot has to be published after
+		 * the current frame.
+		 */
+		bool isRequested(void) const { return m_requested.load(std::memory_order_acquire); }
+
+		/*!
+		 * For the game thread: get an unused snapshot to fill in.
+		 */
+		std::shared_ptr<FieldSnapshot> acquire(void);
+
+		/*!
+		 * For the game thread: make the filled snapshot visible to readers.
+		 */
+		void publish(std::shared_ptr<FieldSnapshot> snapshot);
+};
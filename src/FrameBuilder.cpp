@@ -0,0 +1,93 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include "FrameBuilder.h"
+
+FrameBuilder::FrameBuilder()
+	: m_data(acquire())
+{
+}
+
+std::shared_ptr<std::string> FrameBuilder::acquire(void)
+{
+	// a buffer is free again when only the pool holds a reference
+	for (auto &buffer: m_pool)
+	{
+		if (buffer.use_count() == 1)
+		{
+			// the last other reference may have been dropped by the network
+			// thread; see its reads before writing
+			std::atomic_thread_fence(std::memory_order_acquire);
+			buffer->clear();
+			return buffer;
+		}
+	}
+
+	auto buffer = std::make_shared<std::string>();
+	buffer->reserve(INITIAL_CAPACITY);
+
+	if (m_pool.size() < POOL_SIZE)
+	{
+		m_pool.push_back(buffer);
+	}
+
+	return buffer;
+}
+
+void FrameBuilder::beginMessage(void)
+{
+	m_messageStart = m_data->size();
+	m_data->append(sizeof(uint32_t), '\0');
+}
+
+void FrameBuilder::endMessage(void)
+{
+	std::size_t bodySize = m_data->size() - m_messageStart - sizeof(uint32_t);
+	uint32_t length = htonl(static_cast<uint32_t>(bodySize));
+
+	std::memcpy(&(*m_data)[m_messageStart], &length, sizeof(length));
+}
+
+namespace {
+	/*!
+	 * Holds the pool's buffer while a finished frame is referenced. The
+	 * reference is released as soon as the frame is, even if weak references
+	 * keep the frame's control block around.
+	 */
+	struct PoolReference
+	{
+		std::shared_ptr<std::string> data;
+
+		void operator()(const std::string*) { data.reset(); }
+	};
+}
+
+SharedBuffer FrameBuilder::finish(void)
+{
+	// each frame gets its own reference count, so a frame can be told apart
+	// from a later one reusing the same string (see FrameCompressor)
+	SharedBuffer result(m_data.get(), PoolReference{m_data});
+	m_data = acquire();
+	return result;
+}
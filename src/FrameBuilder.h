@@ -0,0 +1,89 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SharedBuffer.h"
+
+/*!
+ * \brief Collects the length prefixed messages of one frame.
+ *
+ * Messages are packed in place: beginMessage() reserves the 4 byte length
+ * field, which endMessage() fills in once the size is known. The builder
+ * provides write(), so it can be used directly as msgpack stream.
+ *
+ * Finished frames are handed out as SharedBuffer. Their memory is taken from
+ * a small pool and reused as soon as no client references it anymore, so a
+ * running server does not allocate frame buffers. Each finished frame has
+ * its own reference count, so a std::weak_ptr to it expires when the frame
+ * is released, even if the memory is reused later.
+ */
+class FrameBuilder
+{
+	private:
+		// frames stay referenced by client queues and the frame history for
+		// a while, so the pool has to cover a few seconds of frames
+		static constexpr const std::size_t POOL_SIZE = 256;
+		static constexpr const std::size_t INITIAL_CAPACITY = 64*1024;
+
+		std::vector< std::shared_ptr<std::string> > m_pool;
+		std::shared_ptr<std::string> m_data;
+		std::size_t m_messageStart = 0;
+
+		std::shared_ptr<std::string> acquire(void);
+
+	public:
+		FrameBuilder();
+
+		/*!
+		 * Start a new message by reserving space for its length.
+		 */
+		void beginMessage(void);
+
+		/*!
+		 * Finish the current message by writing its length (big endian,
+		 * without the length field itself).
+		 */
+		void endMessage(void);
+
+		/*!
+		 * Append raw data to the current message.
+		 */
+		void write(const char *data, std::size_t size)
+		{
+			m_data->append(data, size);
+		}
+
+		const char* data(void) const { return m_data->data(); }
+		bool empty(void) const { return m_data->empty(); }
+		std::size_t size(void) const { return m_data->size(); }
+
+		/*!
+		 * Discard everything collected so far.
+		 */
+		void clear(void) { m_data->clear(); }
+
+		/*!
+		 * Hand out the collected frame and start a new, empty one.
+		 */
+		SharedBuffer finish(void);
+};
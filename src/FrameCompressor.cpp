@@ -0,0 +1,114 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "FrameCompressor.h"
+
+FrameCompressor::FrameCompressor(int level, const std::string &dictionary)
+	: m_level(level)
+{
+#ifdef HAVE_ZSTD
+	m_context = ZSTD_createCCtx();
+	if (!dictionary.empty())
+	{
+		m_dictionary = ZSTD_createCDict(dictionary.data(), dictionary.size(), level);
+	}
+#endif
+}
+
+FrameCompressor::~FrameCompressor()
+{
+#ifdef HAVE_ZSTD
+	ZSTD_freeCDict(m_dictionary);
+	ZSTD_freeCCtx(m_context);
+#endif
+}
+
+bool FrameCompressor::isAvailable(void)
+{
+#ifdef HAVE_ZSTD
+	return true;
+#else
+	return false;
+#endif
+}
+
+SharedBuffer FrameCompressor::compress(const SharedBuffer &buffer)
+{
+#ifdef HAVE_ZSTD
+	auto cached = m_cache.find(buffer.get());
+	if ((cached != m_cache.end()) && !cached->second.source.expired())
+	{
+		return cached->second.compressed;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::size_t bound = ZSTD_compressBound(buffer->size());
+	auto block = std::make_shared<std::string>(sizeof(uint32_t) + bound, '\0');
+	char *out = &(*block)[sizeof(uint32_t)];
+
+	std::size_t size = m_dictionary
+		? ZSTD_compress_usingCDict(m_context, out, bound, buffer->data(), buffer->size(), m_dictionary)
+		: ZSTD_compressCCtx(m_context, out, bound, buffer->data(), buffer->size(), m_level);
+
+	if (ZSTD_isError(size))
+	{
+		throw std::runtime_error(ZSTD_getErrorName(size));
+	}
+
+	block->resize(sizeof(uint32_t) + size);
+	uint32_t length = htonl(static_cast<uint32_t>(size));
+	std::memcpy(&(*block)[0], &length, sizeof(length));
+
+	m_inputBytes += buffer->size();
+	m_outputBytes += block->size();
+	m_compressedBuffers++;
+	m_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+
+	if (cached != m_cache.end())
+	{
+		// outdated entry for a reused address, it keeps its place in the order
+		cached->second = {buffer, block};
+		return block;
+	}
+
+	if (m_cacheOrder.size() >= CACHE_SIZE)
+	{
+		m_cache.erase(m_cacheOrder.front());
+		m_cacheOrder.pop_front();
+	}
+
+	m_cache[buffer.get()] = {buffer, block};
+	m_cacheOrder.push_back(buffer.get());
+
+	return block;
+#else
+	return buffer;
+#endif
+}
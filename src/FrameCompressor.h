@@ -0,0 +1,107 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "SharedBuffer.h"
+
+#ifdef HAVE_ZSTD
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+#endif
+
+/*!
+ * \brief Compresses serialized frames for clients that requested it.
+ *
+ * Every buffer is compressed into one independent zstd frame, prefixed by
+ * its 4 byte big endian length. The contained messages keep their own
+ * length prefixes, so a client decompresses a block and parses it like the
+ * uncompressed stream.
+ *
+ * Blocks do not depend on each other, so clients can join (or be
+ * resynchronized) at any point and a block is shared by all clients
+ * receiving the same buffer. The results for recently seen buffers are
+ * cached, so each frame is compressed only once. An optional dictionary,
+ * trained on recorded frames, makes up for the lost context between frames.
+ */
+class FrameCompressor
+{
+	private:
+		// covers a keyframe interval of frames plus the variants of the
+		// current frame
+		static constexpr const std::size_t CACHE_SIZE = 256;
+
+		struct CacheEntry
+		{
+			// does not keep the source alive, so pooled frames can be reused;
+			// an expired source means the address may now hold another buffer
+			std::weak_ptr<const std::string> source;
+			SharedBuffer compressed;
+		};
+
+		std::unordered_map<const std::string*, CacheEntry> m_cache;
+		std::deque<const std::string*> m_cacheOrder;
+
+#ifdef HAVE_ZSTD
+		ZSTD_CCtx_s *m_context = nullptr;
+		ZSTD_CDict_s *m_dictionary = nullptr;
+#endif
+		int m_level;
+
+		uint64_t m_inputBytes = 0;
+		uint64_t m_outputBytes = 0;
+		uint64_t m_compressedBuffers = 0;
+		uint64_t m_nanoseconds = 0;
+
+	public:
+		/*!
+		 * \param level        zstd compression level.
+		 * \param dictionary   Raw content of a zstd dictionary, or empty.
+		 */
+		FrameCompressor(int level, const std::string &dictionary);
+		~FrameCompressor();
+
+		FrameCompressor(const FrameCompressor&) = delete;
+		FrameCompressor& operator=(const FrameCompressor&) = delete;
+
+		/*!
+		 * \returns   true if the server was built with compression support.
+		 */
+		static bool isAvailable(void);
+
+		/*!
+		 * \returns   The compressed block for the given buffer.
+		 */
+		SharedBuffer compress(const SharedBuffer &buffer);
+
+		uint64_t getInputBytes(void) const { return m_inputBytes; }
+		uint64_t getOutputBytes(void) const { return m_outputBytes; }
+		uint64_t getCompressedBuffers(void) const { return m_compressedBuffers; }
+		uint64_t getNanoseconds(void) const { return m_nanoseconds; }
+
+		void resetStats(void)
+		{
+			m_inputBytes = m_outputBytes = m_compressedBuffers = m_nanoseconds = 0;
+		}
+};
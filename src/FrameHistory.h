@@ -0,0 +1,64 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "SharedBuffer.h"
+
+/*!
+ * \brief The most recent keyframe and all frames sent after it.
+ *
+ * A keyframe is a serialized world state. Sending it followed by the
+ * buffered frames brings a client to the current state without serializing
+ * anything for it.
+ */
+class FrameHistory
+{
+	private:
+		SharedBuffer m_keyframe;
+		std::vector<SharedBuffer> m_frames;
+
+	public:
+		/*!
+		 * Start a new history. Buffered frames are discarded, as they are
+		 * contained in the new keyframe.
+		 */
+		void setKeyframe(const SharedBuffer &keyframe)
+		{
+			m_keyframe = keyframe;
+			m_frames.clear();
+		}
+
+		/*!
+		 * Append a frame (in the default encoding, unfiltered). Ignored
+		 * until the first keyframe is set.
+		 */
+		void addFrame(const SharedBuffer &frame)
+		{
+			if (m_keyframe)
+			{
+				m_frames.push_back(frame);
+			}
+		}
+
+		bool hasKeyframe(void) const { return static_cast<bool>(m_keyframe); }
+		const SharedBuffer& getKeyframe(void) const { return m_keyframe; }
+		const std::vector<SharedBuffer>& getFrames(void) const { return m_frames; }
+};
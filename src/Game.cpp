@@ -16,22 +16,70 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
 
 #include "config.h"
 #include "Environment.h"
+#ifdef HAVE_SQLITE3
+#include "SqliteDatabase.h"
+#endif
 #include "debug_funcs.h"
 #include "MsgPackUpdateTracker.h"
 #include "Game.h"
 
+// passed by reference to the std::chrono::duration constructor
+constexpr const int Game::DB_POLL_INTERVAL_MS;
+constexpr const int Game::CHECKPOINT_INTERVAL_MS;
+
 Game::Game()
 {
+	auto updateTracker = std::make_unique<MsgPackUpdateTracker>();
+	m_updateTracker = updateTracker.get();
+
+	std::string checkpointFile = Environment::GetDefault(Environment::ENV_CHECKPOINT_FILE, Environment::ENV_CHECKPOINT_FILE_DEFAULT);
+	if (!checkpointFile.empty())
+	{
+		loadCheckpoint(checkpointFile);
+		m_checkpointWriter = std::make_unique<CheckpointWriter>(
+			checkpointFile, m_snapshots, std::chrono::milliseconds(CHECKPOINT_INTERVAL_MS));
+	}
+
+	// a restored field gets its food from the checkpoint
 	m_field = std::make_unique<Field>(
 		config::FIELD_SIZE_X, config::FIELD_SIZE_Y,
-		config::FIELD_STATIC_FOOD,
-		std::make_unique<MsgPackUpdateTracker>()
+		m_restoredCheckpoint ? 0 : config::FIELD_STATIC_FOOD,
+		std::move(updateTracker)
 	);
 
+	MsgPackUpdateTracker gameInfoTracker;
+	gameInfoTracker.gameInfo();
+
+	auto compressor = createCompressor();
+	m_compressionAvailable = (compressor != nullptr);
+
+	SharedBuffer gameInfo = gameInfoTracker.serialize();
+	m_archiveDirectory = Environment::GetDefault(Environment::ENV_ARCHIVE_DIR, Environment::ENV_ARCHIVE_DIR_DEFAULT);
+	m_network = std::make_unique<NetworkThread>(gameInfo, std::move(compressor), m_archiveDirectory);
+
+	std::string recordingFile = Environment::GetDefault(Environment::ENV_RECORDING_FILE, Environment::ENV_RECORDING_FILE_DEFAULT);
+	if (!recordingFile.empty())
+	{
+		try
+		{
+			m_recorder = std::make_unique<GameRecorder>(recordingFile, gameInfo);
+			m_field->setRecordBotInputs(true);
+		}
+		catch (std::exception &e)
+		{
+			std::cerr << "not recording the game: " << e.what() << std::endl;
+		}
+	}
+
 	server.AddConnectionEstablishedListener(
 		[this](TcpSocket& socket)
 		{
@@ -65,17 +113,17 @@ Game::Game()
 		[this](std::shared_ptr<Bot> victim, std::shared_ptr<Bot> killer)
 		{
 			long killer_id = (killer==nullptr) ? -1 : killer->getDatabaseId();
-			m_database->ReportBotKilled(
+			m_databaseWriter->ReportBotKilled({
 				victim->getDatabaseId(),
 				victim->getDatabaseVersionId(),
-				victim->getStartFrame(),
-				m_field->getCurrentFrame(),
+				static_cast<long>(victim->getStartFrame()),
+				static_cast<long>(m_field->getCurrentFrame()),
 				killer_id,
 				victim->getSnake()->getMass(),
 				victim->getConsumedNaturalFood(),
 				victim->getConsumedFoodHuntedByOthers(),
 				victim->getConsumedFoodHuntedBySelf()
-			);
+			});
 
 			createBot(victim->getDatabaseId());
 		}
@@ -86,14 +134,14 @@ bool Game::OnConnectionEstablished(TcpSocket &socket)
 {
 	std::cerr << "connection established to " << socket.GetPeer() << std::endl;
 
-	// send initial state
-	MsgPackUpdateTracker initTracker;
-	initTracker.gameInfo();
-	initTracker.worldState(*m_field);
-	socket.Write(initTracker.serialize());
-
 	socket.SetWriteBlocking(false);
 
+	Client &client = m_clients[&socket];
+	client.connection = std::make_shared<ClientConnection>(socket, config::CLIENT_MAX_QUEUED_BYTES);
+
+	// the initial state is sent by the network thread
+	m_network->addClient(client.connection, m_keyframePublished ? nullptr : getWorldState());
+
 	return true;
 }
 
@@ -101,6 +149,13 @@ bool Game::OnConnectionClosed(TcpSocket &socket)
 {
 	std::cerr << "connection to " << socket.GetPeer() << " closed." << std::endl;
 
+	auto it = m_clients.find(&socket);
+	if (it != m_clients.end())
+	{
+		m_network->removeClient(it->second.connection);
+		m_clients.erase(it);
+	}
+
 	return true;
 }
 
@@ -108,9 +163,18 @@ bool Game::OnDataAvailable(TcpSocket &socket)
 {
 	char data[1024];
 	ssize_t count = socket.Read(data, sizeof(data));
-	if(count > 0) {
-		// return to sender
-		socket.Write(data, count, false);
+
+	auto it = m_clients.find(&socket);
+	if ((count > 0) && (it != m_clients.end()))
+	{
+		Client &client = it->second;
+		client.connection->receive(data, count);
+
+		std::string message;
+		while (client.connection->nextMessage(message))
+		{
+			handleClientMessage(client, message);
+		}
 	}
 	return true;
 }
@@ -119,6 +183,9 @@ bool Game::OnTimerInterval()
 {
 	// do all the game logic here and send updates to clients
 
+	// the world only changes in here
+	m_worldState = nullptr;
+
 	m_field->decayFood();
 	m_field->consumeFood();
 	m_field->removeFood();
@@ -132,16 +199,27 @@ bool Game::OnTimerInterval()
 	m_field->processLog();
 	m_field->tick();
 
-	// send differential update to all connected clients
-	std::string update = m_field->getUpdateTracker().serialize();
-	server.Broadcast(update);
+	// hand the differential update over to the network thread; before
+	// queryDB(), so its changes are part of the next frame and not of the
+	// keyframe
+	publishFrame();
 
-	if (++m_dbQueryCounter >= DB_QUERY_INTERVAL)
+	// readers of the snapshot work on their copy while the next frame is
+	// simulated
+	if (m_snapshots.isRequested())
+	{
+		auto snapshot = m_snapshots.acquire();
+		m_field->saveSnapshot(*snapshot);
+		m_snapshots.publish(std::move(snapshot));
+	}
+
+	if (m_botPoller->hasChanges())
 	{
 		queryDB();
-		m_dbQueryCounter = 0;
 	}
 
+	m_worldState = nullptr;
+
 	return true;
 }
 
@@ -157,9 +235,26 @@ int Game::Main()
 		return -2;
 	}
 
-	for (auto id: m_database->GetActiveBotIds())
+	if (m_restoredCheckpoint)
+	{
+		restoreCheckpoint(m_database->GetActiveBotIds());
+	}
+	else
+	{
+		createBots(m_database->GetActiveBotIds());
+	}
+
+	// the frame number is known only now, if the field was restored
+	if (!m_archiveDirectory.empty())
 	{
-		createBot(id);
+		try
+		{
+			m_archive = std::make_unique<ArchiveWriter>(m_archiveDirectory, m_field->getCurrentFrame() + 1);
+		}
+		catch (std::exception &e)
+		{
+			std::cerr << "not archiving the game: " << e.what() << std::endl;
+		}
 	}
 
 	server.AddIntervalTimer(16666); // 60 fps
@@ -171,8 +266,220 @@ int Game::Main()
 	}
 }
 
-bool Game::connectDB()
+SharedBuffer Game::getWorldState(void)
+{
+	// serialized at most once per state of the world and shared by all
+	// clients that (re)join in between
+	if (!m_worldState)
+	{
+		MsgPackUpdateTracker tracker;
+		tracker.worldState(*m_field);
+		m_worldState = tracker.serialize();
+	}
+
+	return m_worldState;
+}
+
+void Game::publishFrame(void)
+{
+	// serialize each variant of the frame once and share it between the
+	// clients requesting it
+	auto frameSet = std::make_shared<FrameSet>();
+	frameSet->frame = m_updateTracker->serialize();
+
+	bool compactRequested = false;
+	bool viewportRequested = false;
+	for (auto &entry: m_clients)
+	{
+		const ClientSettings &settings = entry.second.settings;
+
+		bool compact = (settings.protocolVersion == MsgPackProtocol::COMPACT_PROTOCOL_VERSION);
+		const viewport::TileSet *tiles = settings.getViewportTiles();
+
+		compactRequested |= compact;
+		viewportRequested |= (tiles != nullptr);
+
+		if (!compact && !tiles)
+		{
+			continue; // the default frame
+		}
+
+		// until the tracker supports a requested variant, the default frame is sent
+		if (frameSet->select(settings) == frameSet->frame)
+		{
+			SharedBuffer frame = m_updateTracker->serialize(compact, tiles);
+			if (frame)
+			{
+				frameSet->variants.push_back({compact, settings.hasViewport, settings.viewportTiles, frame});
+			}
+		}
+	}
+
+	m_updateTracker->reset();
+
+	m_updateTracker->setCompactEncodingEnabled(compactRequested);
+	m_updateTracker->setViewportFilterEnabled(viewportRequested);
+
+	// the next recovery point
+	if (!m_keyframePublished || (++m_keyframeCounter >= KEYFRAME_INTERVAL))
+	{
+		frameSet->keyframe = getWorldState();
+		m_keyframeCounter = 0;
+		m_keyframePublished = true;
+	}
+
+	if (m_recorder)
+	{
+		m_recorder->recordFrame(m_field->getCurrentFrame(), frameSet->frame, frameSet->keyframe, m_field->getBotInputs());
+	}
+
+	if (m_archive)
+	{
+		m_archive->addFrame(m_field->getCurrentFrame(), frameSet->frame, frameSet->keyframe);
+	}
+
+	m_network->publishFrame(std::move(frameSet));
+}
+
+void Game::handleClientMessage(Client &client, const std::string &message)
+{
+	ClientSettings &settings = client.settings;
+	const std::string &peer = client.connection->getPeer();
+	bool resync = false;
+
+	try
+	{
+		msgpack::object_handle handle = msgpack::unpack(message.data(), message.size());
+		const msgpack::object &obj = handle.get();
+
+		if ((obj.type != msgpack::type::ARRAY) || (obj.via.array.size < 2))
+		{
+			throw msgpack::type_error();
+		}
+
+		switch (obj.via.array.ptr[1].as<int>())
+		{
+			case MsgPackProtocol::MESSAGE_TYPE_CLIENT_PROTOCOL_VERSION:
+			{
+				auto request = obj.as<MsgPackProtocol::ClientProtocolVersionMessage>();
+				if ((request.protocol_version == MsgPackProtocol::PROTOCOL_VERSION)
+						|| (request.protocol_version == MsgPackProtocol::COMPACT_PROTOCOL_VERSION))
+				{
+					settings.protocolVersion = request.protocol_version;
+				}
+				break;
+			}
+
+			case MsgPackProtocol::MESSAGE_TYPE_CLIENT_COMPRESSION:
+			{
+				auto request = obj.as<MsgPackProtocol::ClientCompressionMessage>();
+				if ((request.method == MsgPackProtocol::COMPRESSION_NONE)
+						|| ((request.method == MsgPackProtocol::COMPRESSION_ZSTD) && m_compressionAvailable))
+				{
+					settings.compression = request.method;
+				}
+				break;
+			}
+
+			case MsgPackProtocol::MESSAGE_TYPE_CLIENT_VIEWPORT:
+			{
+				auto request = obj.as<MsgPackProtocol::ClientViewportMessage>();
+				const viewport::TileSet *oldTiles = settings.getViewportTiles();
+
+				if (request.has_rect)
+				{
+					viewport::TileSet tiles = viewport::tilesInRect(
+						request.left - config::VIEWPORT_MARGIN,
+						request.top - config::VIEWPORT_MARGIN,
+						request.width + 2*config::VIEWPORT_MARGIN,
+						request.height + 2*config::VIEWPORT_MARGIN);
+
+					// the client knows nothing about the newly visible tiles
+					resync = (oldTiles != nullptr) && (tiles & ~*oldTiles).any();
+					settings.viewportTiles = tiles;
+					settings.hasViewport = true;
+				}
+				else
+				{
+					resync = (oldTiles != nullptr);
+					settings.hasViewport = false;
+				}
+				break;
+			}
+
+			case MsgPackProtocol::MESSAGE_TYPE_CLIENT_REPLAY:
+			{
+				// the stream is switched by the network thread, the settings
+				// stay as they are
+				auto request = obj.as<MsgPackProtocol::ClientReplayMessage>();
+				m_network->replayClient(client.connection, request.has_frame, request.frame);
+				return;
+			}
+
+			default:
+				std::cerr << "unknown message type from " << peer << std::endl;
+				return;
+		}
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << "invalid message from " << peer << ": " << e.what() << std::endl;
+		return;
+	}
+
+	m_network->updateClient(client.connection, settings, resync);
+}
+
+std::unique_ptr<FrameCompressor> Game::createCompressor(void)
+{
+	if (!FrameCompressor::isAvailable())
+	{
+		return nullptr;
+	}
+
+	std::string dictionary;
+	std::string dictionaryPath = Environment::GetDefault(
+			Environment::ENV_COMPRESSION_DICTIONARY, Environment::ENV_COMPRESSION_DICTIONARY_DEFAULT);
+
+	if (!dictionaryPath.empty())
+	{
+		std::ifstream file(dictionaryPath, std::ios::binary);
+		if (!file)
+		{
+			std::cerr << "cannot read compression dictionary " << dictionaryPath << std::endl;
+		}
+		else
+		{
+			std::ostringstream content;
+			content << file.rdbuf();
+			dictionary = content.str();
+		}
+	}
+
+	return std::make_unique<FrameCompressor>(config::STREAM_COMPRESSION_LEVEL, dictionary);
+}
+
+std::unique_ptr<db::IDatabase> Game::createDatabase(void)
 {
+	std::string backend = Environment::GetDefault(
+			Environment::ENV_DATABASE_BACKEND, Environment::ENV_DATABASE_BACKEND_DEFAULT);
+
+	if (backend == "sqlite")
+	{
+#ifdef HAVE_SQLITE3
+		auto db = std::make_unique<db::SqliteDatabase>();
+		db->Connect(Environment::GetDefault(Environment::ENV_SQLITE_DB, Environment::ENV_SQLITE_DB_DEFAULT));
+		return std::move(db);
+#else
+		throw std::runtime_error("this server was built without SQLite support");
+#endif
+	}
+
+	if (backend != "mysql")
+	{
+		throw std::runtime_error("unknown database backend: " + backend);
+	}
+
 	auto db = std::make_unique<db::MysqlDatabase>();
 	db->Connect(
 		Environment::GetDefault(Environment::ENV_MYSQL_HOST, Environment::ENV_MYSQL_HOST_DEFAULT),
@@ -180,36 +487,55 @@ bool Game::connectDB()
 		Environment::GetDefault(Environment::ENV_MYSQL_PASSWORD, Environment::ENV_MYSQL_PASSWORD_DEFAULT),
 		Environment::GetDefault(Environment::ENV_MYSQL_DB, Environment::ENV_MYSQL_DB_DEFAULT)
 	);
-	m_database = std::move(db);
+	return std::move(db);
+}
+
+bool Game::connectDB()
+{
+	m_database = createDatabase();
+
+#ifdef HAVE_SQLITE3
+	std::string botDir = Environment::GetDefault(Environment::ENV_SQLITE_BOT_DIR, Environment::ENV_SQLITE_BOT_DIR_DEFAULT);
+	auto sqlite = dynamic_cast<db::SqliteDatabase*>(m_database.get());
+	if ((sqlite != nullptr) && !botDir.empty())
+	{
+		sqlite->ImportBots(botDir, std::atoi(Environment::GetDefault(
+				Environment::ENV_SQLITE_BOT_COPIES, Environment::ENV_SQLITE_BOT_COPIES_DEFAULT)));
+	}
+#endif
+
+	// results are written on a separate connection, so a slow database
+	// does not stall the game
+	m_databaseWriter = std::make_unique<db::DatabaseWriter>(createDatabase);
+	m_botPoller = std::make_unique<db::ActiveBotPoller>(createDatabase,
+			std::chrono::milliseconds(DB_POLL_INTERVAL_MS));
 	return true;
 }
 
 void Game::queryDB()
 {
-	auto active_ids = m_database->GetActiveBotIds();
-	for (auto id: active_ids)
+	auto changes = m_botPoller->takeChanges();
+
+	std::vector<int> newBotIds;
+	for (auto id: changes.activated)
 	{
 		if (m_field->getBotByDatabaseId(id) == nullptr)
 		{
-			createBot(id);
+			newBotIds.push_back(id);
 		}
 	}
+	createBots(newBotIds);
 
-	std::vector<std::shared_ptr<Bot>> kill_bots;
-	for (auto& bot: m_field->getBots())
+	for (auto id: changes.deactivated)
 	{
-		if (std::find(active_ids.begin(), active_ids.end(), bot->getDatabaseId()) == active_ids.end())
+		auto bot = m_field->getBotByDatabaseId(id);
+		if (bot != nullptr)
 		{
-			kill_bots.push_back(bot);
+			m_field->killBot(bot, bot); // suicide!
 		}
 	}
 
-	for (auto& bot: kill_bots)
-	{
-		m_field->killBot(bot, bot); // suicide!
-	}
-
-	for (auto& cmd: m_database->GetActiveCommands())
+	for (auto& cmd: changes.commands)
 	{
 		if (cmd.command == db::Command::CMD_KILL)
 		{
@@ -217,16 +543,16 @@ void Game::queryDB()
 			if (bot != nullptr)
 			{
 				m_field->killBot(bot, bot); // suicide!
-				m_database->SetCommandCompleted(cmd.id, true, "killed");
+				m_databaseWriter->SetCommandCompleted(cmd.id, true, "killed");
 			}
 			else
 			{
-				m_database->SetCommandCompleted(cmd.id, false, "bot not known / not active");
+				m_databaseWriter->SetCommandCompleted(cmd.id, false, "bot not known / not active");
 			}
 		}
 		else
 		{
-			m_database->SetCommandCompleted(cmd.id, false, "command not known");
+			m_databaseWriter->SetCommandCompleted(cmd.id, false, "command not known");
 		}
 	}
 }
@@ -247,3 +573,76 @@ void Game::createBot(int bot_id)
 		// TODO save error message, maybe lock version in inactive state
 	}
 }
+
+void Game::disableFailedBots(const std::vector< std::shared_ptr<Bot> > &bots, const std::vector<std::string> &initErrorMessages)
+{
+	for (std::size_t i=0; i<bots.size(); i++)
+	{
+		if (!initErrorMessages[i].empty())
+		{
+			m_database->DisableBotVersion(bots[i]->getDatabaseVersionId(), initErrorMessages[i]);
+		}
+	}
+}
+
+void Game::loadCheckpoint(const std::string &filename)
+{
+	try
+	{
+		m_restoredCheckpoint = MappedCheckpoint::open(filename);
+	}
+	catch (std::exception &e)
+	{
+		std::cerr << "ignoring checkpoint: " << e.what() << std::endl;
+		return;
+	}
+
+	if (!m_restoredCheckpoint)
+	{
+		return;
+	}
+
+	const Checkpoint::Header &header = m_restoredCheckpoint->getHeader();
+	if ((header.fieldWidth != config::FIELD_SIZE_X) || (header.fieldHeight != config::FIELD_SIZE_Y))
+	{
+		std::cerr << "ignoring checkpoint: it was saved with a different field size" << std::endl;
+		m_restoredCheckpoint = nullptr;
+		return;
+	}
+
+	std::cerr << "resuming from checkpoint " << filename << " at frame " << header.frame << std::endl;
+}
+
+void Game::restoreCheckpoint(const std::vector<int> &bot_ids)
+{
+	std::set<int> savedIds;
+	for (auto &record: m_restoredCheckpoint->getBots())
+	{
+		savedIds.insert(record.databaseId);
+	}
+
+	// bots deactivated since the checkpoint are dropped, new ones start
+	// from scratch
+	std::vector<int> restoredIds;
+	std::vector<int> newIds;
+	for (int id: bot_ids)
+	{
+		(savedIds.count(id) ? restoredIds : newIds).push_back(id);
+	}
+
+	std::vector<std::string> initErrorMessages;
+	auto bots = m_field->restoreCheckpoint(
+		*m_restoredCheckpoint, m_database->GetBotDataBatch(restoredIds), initErrorMessages);
+	disableFailedBots(bots, initErrorMessages);
+
+	m_restoredCheckpoint = nullptr;
+
+	createBots(newIds);
+}
+
+void Game::createBots(const std::vector<int> &bot_ids)
+{
+	std::vector<std::string> initErrorMessages;
+	auto bots = m_field->newBots(m_database->GetBotDataBatch(bot_ids), initErrorMessages);
+	disableFailedBots(bots, initErrorMessages);
+}
@@ -18,30 +18,74 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 
 #include <TcpServer/TcpServer.h>
 
 #include "UpdateTracker.h"
 #include "Field.h"
+#include "ActiveBotPoller.h"
+#include "Checkpoint.h"
+#include "CheckpointWriter.h"
+#include "FieldSnapshot.h"
+#include "GameRecorder.h"
 #include "Database.h"
+#include "DatabaseWriter.h"
+#include "ClientConnection.h"
+#include "MsgPackUpdateTracker.h"
+#include "NetworkThread.h"
+#include "SpectatorArchive.h"
 
 class Game
 {
 	private:
-		static constexpr const int DB_QUERY_INTERVAL = 60;
+		static constexpr const int DB_POLL_INTERVAL_MS = 1000;
 		static constexpr const int STREAM_STATS_UPDATE_INTERVAL = 60;
 		static constexpr const int DB_STATS_UPDATE_INTERVAL = 600;
+		static constexpr const int KEYFRAME_INTERVAL = 120;
+		static constexpr const int CHECKPOINT_INTERVAL_MS = 60000;
+
+		struct Client
+		{
+			std::shared_ptr<ClientConnection> connection; // input is read here, output belongs to m_network
+			ClientSettings settings;
+		};
 
 		TcpServer server;
 		std::unique_ptr<Field> m_field;
+		MsgPackUpdateTracker *m_updateTracker; // owned by m_field
 		std::unique_ptr<db::IDatabase> m_database;
-		int m_dbQueryCounter = 0;
+		std::unique_ptr<db::DatabaseWriter> m_databaseWriter;
+		std::unique_ptr<db::ActiveBotPoller> m_botPoller;
+		std::map<TcpSocket*, Client> m_clients;
+
+		SharedBuffer m_worldState; // cached until the world changes
+		std::unique_ptr<NetworkThread> m_network;
+		bool m_compressionAvailable = false;
+		bool m_keyframePublished = false;
 		int m_streamStatsUpdateCounter = 0;
+		int m_keyframeCounter = 0;
+
+		SnapshotPublisher m_snapshots;
+		std::unique_ptr<MappedCheckpoint> m_restoredCheckpoint; // until the bots are restored
+		std::unique_ptr<CheckpointWriter> m_checkpointWriter;
+		std::unique_ptr<GameRecorder> m_recorder;
+		std::string m_archiveDirectory;
+		std::unique_ptr<ArchiveWriter> m_archive;
 
+		static std::unique_ptr<db::IDatabase> createDatabase(void);
 		bool connectDB();
 		void queryDB();
 		void createBot(int bot_id);
+		void createBots(const std::vector<int> &bot_ids);
+		void disableFailedBots(const std::vector< std::shared_ptr<Bot> > &bots, const std::vector<std::string> &initErrorMessages);
+		void loadCheckpoint(const std::string &filename);
+		void restoreCheckpoint(const std::vector<int> &bot_ids);
+		std::unique_ptr<FrameCompressor> createCompressor(void);
+		SharedBuffer getWorldState(void);
+		void publishFrame(void);
+		void handleClientMessage(Client &client, const std::string &message);
 
 	public:
 		Game();
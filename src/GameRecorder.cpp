@@ -0,0 +1,270 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "GameRecorder.h"
+
+static const char RECORDING_MAGIC[8] = {'S', 'P', 'N', 'R', 'E', 'C', '\0', '\0'};
+static const uint32_t RECORDING_BYTE_ORDER = 0x01020304;
+static const std::size_t RECORDING_ALIGNMENT = 8;
+
+static std::runtime_error systemError(const std::string &what, const std::string &filename)
+{
+	return std::runtime_error(what + " " + filename + ": " + std::strerror(errno));
+}
+
+GameRecorder::GameRecorder(const std::string &filename, SharedBuffer gameInfo)
+{
+	std::string indexFilename = filename + Recording::INDEX_SUFFIX;
+
+	m_logFd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+	if (m_logFd < 0)
+	{
+		throw systemError("cannot open", filename);
+	}
+
+	m_indexFd = open(indexFilename.c_str(), O_RDWR | O_CREAT, 0644);
+	if (m_indexFd < 0)
+	{
+		std::runtime_error error = systemError("cannot open", indexFilename);
+		close(m_logFd);
+		throw error;
+	}
+
+	try
+	{
+		struct stat st;
+		if (fstat(m_indexFd, &st) != 0)
+		{
+			throw systemError("cannot stat", indexFilename);
+		}
+
+		// drop what was not completely written when the server stopped
+		off_t entrySize = sizeof(Recording::IndexEntry);
+		off_t indexSize = st.st_size - (st.st_size % entrySize);
+		Recording::IndexEntry last;
+		if ((indexSize > 0)
+				&& (pread(m_indexFd, &last, sizeof(last), indexSize - sizeof(last)) == sizeof(last)))
+		{
+			Recording::Header header;
+			if ((pread(m_logFd, &header, sizeof(header), 0) != sizeof(header))
+					|| (std::memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0)
+					|| (header.version != Recording::FORMAT_VERSION)
+					|| (header.byteOrder != RECORDING_BYTE_ORDER))
+			{
+				throw std::runtime_error(filename + " is not a recording of this version");
+			}
+			m_logSize = last.offset + last.size;
+
+			// the game does not continue exactly where the log ends
+			m_gap = true;
+		}
+		else
+		{
+			indexSize = 0;
+			m_logSize = 0;
+		}
+
+		m_indexSize = static_cast<uint64_t>(indexSize);
+		if ((ftruncate(m_indexFd, indexSize) != 0) || (ftruncate(m_logFd, m_logSize) != 0)
+				|| (lseek(m_indexFd, 0, SEEK_END) < 0) || (lseek(m_logFd, 0, SEEK_END) < 0))
+		{
+			throw systemError("cannot truncate", filename);
+		}
+
+		if (m_logSize == 0)
+		{
+			Recording::Header header;
+			std::memset(&header, 0, sizeof(header));
+			std::memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+			header.version = Recording::FORMAT_VERSION;
+			header.byteOrder = RECORDING_BYTE_ORDER;
+
+			writeAll(m_logFd, &header, sizeof(header));
+			m_logSize = sizeof(header);
+			writeBlock(Recording::BLOCK_GAME_INFO, 0, gameInfo->data(), gameInfo->size());
+		}
+	}
+	catch (...)
+	{
+		close(m_logFd);
+		close(m_indexFd);
+		throw;
+	}
+
+	m_thread = std::thread([this]() { run(); });
+}
+
+GameRecorder::~GameRecorder()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	m_framesAvailable.notify_one();
+	m_thread.join();
+
+	close(m_logFd);
+	close(m_indexFd);
+}
+
+void GameRecorder::recordFrame(uint32_t frame, SharedBuffer update, SharedBuffer keyframe,
+		std::vector<Recording::BotInput> botInputs)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_queue.size() >= MAX_QUEUED_FRAMES)
+		{
+			if (m_droppedFrames++ == 0)
+			{
+				std::cerr << "recording does not keep up, dropping frames" << std::endl;
+			}
+			m_gap = true;
+			return;
+		}
+		m_queue.push_back({frame, std::move(update), std::move(keyframe), std::move(botInputs), m_gap});
+		m_gap = false;
+	}
+	m_framesAvailable.notify_one();
+}
+
+void GameRecorder::run(void)
+{
+	std::vector<QueuedFrame> frames;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_framesAvailable.wait(lock, [this]() { return m_shutdown || !m_queue.empty(); });
+		if (m_queue.empty())
+		{
+			return; // shutdown
+		}
+
+		frames.swap(m_queue);
+		m_droppedFrames = 0;
+		lock.unlock();
+
+		try
+		{
+			for (auto &frame: frames)
+			{
+				writeFrame(frame);
+			}
+		}
+		catch (std::exception &e)
+		{
+			std::cerr << "recording failed: " << e.what() << std::endl;
+			m_writeFailed = true;
+		}
+
+		frames.clear();
+		lock.lock();
+	}
+}
+
+void GameRecorder::writeFrame(const QueuedFrame &frame)
+{
+	Recording::IndexEntry entry;
+	entry.frame = frame.frame;
+	entry.flags = 0;
+	if (frame.keyframe)
+	{
+		entry.flags |= Recording::INDEX_KEYFRAME;
+	}
+	if (frame.afterGap || m_writeFailed)
+	{
+		entry.flags |= Recording::INDEX_AFTER_GAP;
+	}
+	entry.offset = m_logSize;
+
+	try
+	{
+		writeBlock(Recording::BLOCK_UPDATE, frame.frame, frame.update->data(), frame.update->size());
+		writeBlock(Recording::BLOCK_BOT_INPUTS, frame.frame,
+				frame.botInputs.data(), frame.botInputs.size() * sizeof(Recording::BotInput));
+		if (frame.keyframe)
+		{
+			writeBlock(Recording::BLOCK_WORLD_STATE, frame.frame, frame.keyframe->data(), frame.keyframe->size());
+		}
+
+		entry.size = m_logSize - entry.offset;
+		writeAll(m_indexFd, &entry, sizeof(entry));
+	}
+	catch (...)
+	{
+		// remove the incomplete frame, so the next one is appended to the
+		// last complete frame
+		m_logSize = entry.offset;
+		if ((ftruncate(m_logFd, m_logSize) != 0) || (ftruncate(m_indexFd, m_indexSize) != 0))
+		{
+			std::cerr << "cannot truncate the recording: " << std::strerror(errno) << std::endl;
+		}
+		lseek(m_logFd, 0, SEEK_END);
+		lseek(m_indexFd, 0, SEEK_END);
+		throw;
+	}
+
+	m_indexSize += sizeof(entry);
+	m_writeFailed = false;
+}
+
+void GameRecorder::writeBlock(uint32_t type, uint32_t frame, const void *data, std::size_t size)
+{
+	static const char padding[RECORDING_ALIGNMENT] = {0};
+
+	Recording::BlockHeader header;
+	header.type = type;
+	header.frame = frame;
+	header.size = size;
+
+	std::size_t paddingSize = (RECORDING_ALIGNMENT - size % RECORDING_ALIGNMENT) % RECORDING_ALIGNMENT;
+
+	writeAll(m_logFd, &header, sizeof(header));
+	writeAll(m_logFd, data, size);
+	writeAll(m_logFd, padding, paddingSize);
+
+	m_logSize += sizeof(header) + size + paddingSize;
+}
+
+void GameRecorder::writeAll(int fd, const void *data, std::size_t size)
+{
+	const char *pos = static_cast<const char*>(data);
+	while (size > 0)
+	{
+		ssize_t written = write(fd, pos, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			throw systemError("cannot write", "recording");
+		}
+		pos += written;
+		size -= static_cast<std::size_t>(written);
+	}
+}
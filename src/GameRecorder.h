@@ -0,0 +1,97 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Recording.h"
+#include "SharedBuffer.h"
+
+/*!
+ * \brief Appends the played frames to a recording on a background thread.
+ *
+ * The recorder only keeps references to the buffers that were serialized
+ * for the clients anyway. If the disk does not keep up, frames are dropped
+ * and the next recorded frame is flagged with Recording::INDEX_AFTER_GAP;
+ * a replay continues at the next keyframe.
+ *
+ * \see Recording for the file format.
+ */
+class GameRecorder
+{
+	public:
+		/*!
+		 * Open the log and index for appending and create them if they do
+		 * not exist.
+		 *
+		 * \param gameInfo   Game info message, recorded once for a new log.
+		 * \throws std::runtime_error if a file cannot be opened.
+		 */
+		GameRecorder(const std::string &filename, SharedBuffer gameInfo);
+
+		/*!
+		 * Writes all queued frames and stops the thread.
+		 */
+		~GameRecorder();
+
+		GameRecorder(const GameRecorder&) = delete;
+		GameRecorder& operator=(const GameRecorder&) = delete;
+
+		/*!
+		 * \param keyframe   World state after the frame, or nullptr.
+		 */
+		void recordFrame(uint32_t frame, SharedBuffer update, SharedBuffer keyframe,
+				std::vector<Recording::BotInput> botInputs);
+
+	private:
+		static constexpr const std::size_t MAX_QUEUED_FRAMES = 600;
+
+		struct QueuedFrame
+		{
+			uint32_t frame;
+			SharedBuffer update;
+			SharedBuffer keyframe;
+			std::vector<Recording::BotInput> botInputs;
+			bool afterGap; //!< frames before this one were dropped
+		};
+
+		int m_logFd = -1;
+		int m_indexFd = -1;
+		uint64_t m_logSize = 0;   // up to the end of the last complete frame
+		uint64_t m_indexSize = 0;
+		bool m_writeFailed = false; // frames were lost, used by the thread only
+
+		std::mutex m_mutex;
+		std::condition_variable m_framesAvailable;
+		std::vector<QueuedFrame> m_queue;
+		std::size_t m_droppedFrames = 0;
+		bool m_gap = false;
+		bool m_shutdown = false;
+
+		std::thread m_thread;
+
+		void run(void);
+		void writeFrame(const QueuedFrame &frame);
+		void writeBlock(uint32_t type, uint32_t frame, const void *data, std::size_t size);
+		void writeAll(int fd, const void *data, std::size_t size);
+};
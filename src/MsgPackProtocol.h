@@ -18,12 +18,18 @@
 
 #pragma once
 
+#include <cmath>
 #include <cstdint>
+#include <string>
 #include <vector>
 
+#include <arpa/inet.h>
+
 #include <msgpack.hpp>
 
 #include "types.h"
+#include "config.h"
+#include "Viewport.h"
 
 #include "Field.h"
 #include "Bot.h"
@@ -34,6 +40,7 @@ namespace MsgPackProtocol
 	{
 		MESSAGE_TYPE_GAME_INFO = 0x00,
 		MESSAGE_TYPE_WORLD_UPDATE = 0x01,
+		MESSAGE_TYPE_STREAM_COMPRESSION = 0x02,
 
 		MESSAGE_TYPE_TICK = 0x10,
 
@@ -49,10 +56,184 @@ namespace MsgPackProtocol
 		MESSAGE_TYPE_FOOD_DECAY = 0x32,
 
 		MESSAGE_TYPE_PLAYER_INFO = 0xF0,
+
+		// client -> server
+		MESSAGE_TYPE_CLIENT_PROTOCOL_VERSION = 0x80,
+		MESSAGE_TYPE_CLIENT_VIEWPORT = 0x81,
+		MESSAGE_TYPE_CLIENT_COMPRESSION = 0x82,
+		MESSAGE_TYPE_CLIENT_REPLAY = 0x83,
+	};
+
+	/*!
+	 * Compression of the stream, requested with ClientCompressionMessage.
+	 *
+	 * The server answers with a StreamCompressionMessage, after which the
+	 * stream consists of blocks: a 4 byte big endian length followed by a
+	 * zstd frame. A decompressed block contains complete, length prefixed
+	 * messages, as they are sent without compression. If the server was
+	 * started with a dictionary, the client needs the same dictionary to
+	 * decompress the blocks (its ID is stored in each zstd frame).
+	 *
+	 * A request for an unsupported method is ignored.
+	 */
+	enum
+	{
+		COMPRESSION_NONE = 0,
+		COMPRESSION_ZSTD = 1,
 	};
 
 	static constexpr const uint8_t PROTOCOL_VERSION = 1;
 
+	/*!
+	 * Compact encoding, used for clients that request it with a
+	 * ClientProtocolVersionMessage. It changes the layout of the food spawn,
+	 * food decay, bot move and bot move head messages (which are then tagged
+	 * with this version); all other messages are sent unchanged.
+	 *
+	 * - positions are 16 bit fixed point values relative to the world size
+	 *   (see quantizeX()/quantizeY())
+	 * - messages with items carry a base GUID in front of the item list; the
+	 *   GUIDs of the items are sent as (signed) difference to it, which MsgPack
+	 *   encodes in one to three bytes in most cases
+	 * - segment lists are binary blobs of big endian (x, y) uint16 pairs
+	 * - head movement is sent as the first head position followed by a blob
+	 *   of big endian uint16 headings (see quantizeAngle()) for the
+	 *   following steps, each SNAKE_DISTANCE_PER_STEP long
+	 */
+	static constexpr const uint8_t COMPACT_PROTOCOL_VERSION = 2;
+
+	inline uint16_t quantize(real_t value, real_t range)
+	{
+		// wraps around, just like the coordinates do
+		return static_cast<uint16_t>(static_cast<uint32_t>(std::lround(value / range * 65536)) & 0xFFFF);
+	}
+
+	inline uint16_t quantizeX(real_t x) { return quantize(x, config::FIELD_SIZE_X); }
+	inline uint16_t quantizeY(real_t y) { return quantize(y, config::FIELD_SIZE_Y); }
+	inline uint16_t quantizeAngle(real_t angle) { return quantize(angle, static_cast<real_t>(2*M_PI)); }
+
+	/*!
+	 * Array of items that are packed as soon as they are added, so the source
+	 * data does not have to be kept or copied until the message is sent.
+	 * Packing the list writes the array header followed by the packed items.
+	 *
+	 * Items can be tagged with the viewport tiles they touch. While a filter is
+	 * set, only the items touching one of the filter's tiles are packed.
+	 */
+	class PackedItemList
+	{
+		private:
+			std::string m_data;
+			uint32_t m_count = 0;
+
+			bool m_hasBaseGuid = false;
+			guid_t m_baseGuid = 0;
+
+			// only filled for tagged items
+			std::vector<std::size_t> m_offsets;
+			std::vector<viewport::TileSet> m_tileSets;
+
+			mutable const viewport::TileSet *m_filter = nullptr;
+
+			bool isSelected(std::size_t i) const
+			{
+				return (m_filter == nullptr) || m_tileSets.empty() || (m_tileSets[i] & *m_filter).any();
+			}
+
+		public:
+			template <class T> void add(const T &item)
+			{
+				msgpack::pack(*this, item);
+				m_count++;
+			}
+
+			template <class T> void add(const T &item, const viewport::TileSet &tiles)
+			{
+				m_offsets.push_back(m_data.size());
+				m_tileSets.push_back(tiles);
+				add(item);
+			}
+
+			/*!
+			 * GUIDs in the compact encoding are sent relative to a base GUID
+			 * (the first one passed here), so items do not depend on each
+			 * other and can be filtered.
+			 *
+			 * \returns   The difference of guid to the base GUID.
+			 */
+			int64_t guidDelta(guid_t guid)
+			{
+				if (!m_hasBaseGuid)
+				{
+					m_baseGuid = guid;
+					m_hasBaseGuid = true;
+				}
+				return static_cast<int64_t>(guid - m_baseGuid);
+			}
+
+			guid_t getBaseGuid(void) const { return m_baseGuid; }
+
+			/*!
+			 * Restrict packing to items touching the given tiles, or pack all
+			 * items if filter is nullptr. Untagged lists ignore the filter.
+			 */
+			void setFilter(const viewport::TileSet *filter) const { m_filter = filter; }
+
+			// msgpack stream interface
+			void write(const char *data, std::size_t size) { m_data.append(data, size); }
+
+			void clear(void)
+			{
+				m_data.clear();
+				m_count = 0;
+				m_hasBaseGuid = false;
+				m_baseGuid = 0;
+				m_offsets.clear();
+				m_tileSets.clear();
+			}
+
+			/*!
+			 * \returns   The number of items selected by the current filter.
+			 */
+			uint32_t size(void) const
+			{
+				if ((m_filter == nullptr) || m_tileSets.empty())
+				{
+					return m_count;
+				}
+
+				uint32_t count = 0;
+				for (std::size_t i = 0; i < m_count; i++)
+				{
+					count += isSelected(i);
+				}
+				return count;
+			}
+
+			bool empty(void) const { return size() == 0; }
+
+			template <typename Stream> void packTo(msgpack::packer<Stream> &o) const
+			{
+				o.pack_array(size());
+
+				// the items are packed already: pack_bin_body() appends them unchanged
+				if ((m_filter == nullptr) || m_tileSets.empty())
+				{
+					o.pack_bin_body(m_data.data(), static_cast<uint32_t>(m_data.size()));
+					return;
+				}
+
+				for (std::size_t i = 0; i < m_count; i++)
+				{
+					if (isSelected(i))
+					{
+						std::size_t end = (i+1 < m_count) ? m_offsets[i+1] : m_data.size();
+						o.pack_bin_body(m_data.data() + m_offsets[i], static_cast<uint32_t>(end - m_offsets[i]));
+					}
+				}
+			}
+	};
+
 	struct GameInfoMessage
 	{
 		double world_size_x = 0;
@@ -70,6 +251,11 @@ namespace MsgPackProtocol
 		guid_t player_id; // id der von dieser Verbindung gesteuerten Schlange
 	};
 
+	struct StreamCompressionMessage
+	{
+		uint8_t method; // everything after this message uses this method
+	};
+
 	struct TickMessage
 	{
 		guid_t frame_id; // frame counter since start of server
@@ -77,8 +263,8 @@ namespace MsgPackProtocol
 
 	struct WorldUpdateMessage
 	{
-		Field::BotSet bots;
-		std::vector<Food> food;
+		const Field::BotSet *bots;
+		Field::FoodMap *food; // packed directly from the map
 	};
 
 	struct BotSpawnMessage
@@ -89,14 +275,15 @@ namespace MsgPackProtocol
 	struct BotMoveItem
 	{
 		guid_t bot_id;
-		std::vector< Snake::Segment > new_segments;
+		const Snake::SegmentList *segments; // the first new_segment_count entries are new
+		std::size_t new_segment_count;
 		uint32_t current_length;
 		uint32_t current_segment_radius;
 	};
 
 	struct BotMoveMessage
 	{
-		std::vector<BotMoveItem> items;
+		PackedItemList items; // BotMoveItem
 	};
 
 	struct BotMoveHeadItem
@@ -105,12 +292,12 @@ namespace MsgPackProtocol
 		double mass;
 
 		// one head position for each step moved in this frame, in temporal order
-		std::vector< Vector2D > new_head_positions;
+		const Snake::PositionList *new_head_positions;
 	};
 
 	struct BotMoveHeadMessage
 	{
-		std::vector<BotMoveHeadItem> items;
+		PackedItemList items; // BotMoveHeadItem
 	};
 
 	struct BotKillMessage
@@ -121,7 +308,7 @@ namespace MsgPackProtocol
 
 	struct FoodSpawnMessage
 	{
-		std::vector<Food> new_food;
+		PackedItemList new_food; // Food
 	};
 
 	struct FoodConsumeItem
@@ -132,12 +319,12 @@ namespace MsgPackProtocol
 
 	struct FoodConsumeMessage
 	{
-		std::vector<FoodConsumeItem> items;
+		PackedItemList items; // FoodConsumeItem
 	};
 
 	struct FoodDecayMessage
 	{
-		std::vector<guid_t> food_ids; // food is deleted in this frame
+		PackedItemList food_ids; // guid_t; food is deleted in this frame
 	};
 
 	struct BotStatsItem
@@ -164,6 +351,87 @@ namespace MsgPackProtocol
 	{
 		std::vector<BotLogItem> items;
 	};
+
+	/* Compact encoding (COMPACT_PROTOCOL_VERSION) */
+
+	struct CompactFoodSpawnItem
+	{
+		int64_t food_id_delta;
+		const Food *food;
+	};
+
+	struct CompactFoodSpawnMessage
+	{
+		PackedItemList items; // CompactFoodSpawnItem
+	};
+
+	struct CompactFoodDecayMessage
+	{
+		PackedItemList food_id_deltas; // int64_t
+	};
+
+	struct CompactBotMoveItem
+	{
+		int64_t bot_id_delta;
+		const Snake::SegmentList *segments; // the first new_segment_count entries are new
+		std::size_t new_segment_count;
+		uint32_t current_length;
+		uint32_t current_segment_radius;
+	};
+
+	struct CompactBotMoveMessage
+	{
+		PackedItemList items; // CompactBotMoveItem
+	};
+
+	struct CompactBotMoveHeadItem
+	{
+		int64_t bot_id_delta;
+		double mass;
+		const Snake::PositionList *new_head_positions;
+	};
+
+	struct CompactBotMoveHeadMessage
+	{
+		PackedItemList items; // CompactBotMoveHeadItem
+	};
+
+	/* Client requests */
+
+	struct ClientProtocolVersionMessage
+	{
+		uint8_t protocol_version; // PROTOCOL_VERSION or COMPACT_PROTOCOL_VERSION
+	};
+
+	struct ClientCompressionMessage
+	{
+		uint8_t method; // COMPRESSION_NONE or COMPRESSION_ZSTD
+	};
+
+	struct ClientViewportMessage
+	{
+		// without a rectangle the client receives updates for the whole field
+		bool has_rect = false;
+		real_t left = 0;
+		real_t top = 0;
+		real_t width = 0;
+		real_t height = 0;
+	};
+
+	/*!
+	 * Watch the game from a past frame, if the server keeps an archive.
+	 *
+	 * The server sends the world state at the closest keyframe before the
+	 * frame and the updates from there on, one per live frame, in the
+	 * default encoding and without compression. When the replay reaches the
+	 * live game, the client is resynchronized and its settings apply again.
+	 */
+	struct ClientReplayMessage
+	{
+		// without a frame the client returns to the live game
+		bool has_frame = false;
+		uint32_t frame = 0;
+	};
 }
 
 namespace msgpack {
@@ -200,6 +468,18 @@ namespace msgpack {
 				}
 			};
 
+			template <> struct pack<MsgPackProtocol::StreamCompressionMessage>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::StreamCompressionMessage const& v) const
+				{
+					o.pack_array(3);
+					o.pack(MsgPackProtocol::PROTOCOL_VERSION);
+					o.pack(static_cast<int>(MsgPackProtocol::MESSAGE_TYPE_STREAM_COMPRESSION));
+					o.pack(v.method);
+					return o;
+				}
+			};
+
 			template <> struct pack<MsgPackProtocol::TickMessage>
 			{
 				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::TickMessage const& v) const
@@ -219,8 +499,13 @@ namespace msgpack {
 					o.pack_array(4);
 					o.pack(MsgPackProtocol::PROTOCOL_VERSION);
 					o.pack(static_cast<int>(MsgPackProtocol::MESSAGE_TYPE_WORLD_UPDATE));
-					o.pack(v.bots);
-					o.pack(v.food);
+					o.pack(*v.bots);
+
+					o.pack_array(static_cast<uint32_t>(v.food->size()));
+					for (auto &food: *v.food)
+					{
+						o.pack(food);
+					}
 					return o;
 				}
 			};
@@ -255,7 +540,11 @@ namespace msgpack {
 				{
 					o.pack_array(4);
 					o.pack(v.bot_id);
-					o.pack(v.new_segments);
+					o.pack_array(static_cast<uint32_t>(v.new_segment_count));
+					for (std::size_t i = 0; i < v.new_segment_count; i++)
+					{
+						o.pack((*v.segments)[i]);
+					}
 					o.pack(v.current_length);
 					o.pack(v.current_segment_radius);
 					return o;
@@ -281,7 +570,16 @@ namespace msgpack {
 					o.pack_array(3);
 					o.pack(v.bot_id);
 					o.pack(v.mass);
-					o.pack(v.new_head_positions);
+					o.pack(*v.new_head_positions);
+					return o;
+				}
+			};
+
+			template <> struct pack<MsgPackProtocol::PackedItemList>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::PackedItemList const& v) const
+				{
+					v.packTo(o);
 					return o;
 				}
 			};
@@ -396,6 +694,183 @@ namespace msgpack {
 				}
 			};
 
+			template <> struct pack<MsgPackProtocol::CompactFoodSpawnMessage>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::CompactFoodSpawnMessage const& v) const
+				{
+					o.pack_array(4);
+					o.pack(MsgPackProtocol::COMPACT_PROTOCOL_VERSION);
+					o.pack(static_cast<int>(MsgPackProtocol::MESSAGE_TYPE_FOOD_SPAWN));
+					o.pack(v.items.getBaseGuid());
+					o.pack(v.items);
+					return o;
+				}
+			};
+
+			template <> struct pack<MsgPackProtocol::CompactFoodSpawnItem>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::CompactFoodSpawnItem const& v) const
+				{
+					o.pack_array(4);
+					o.pack(v.food_id_delta);
+					o.pack(MsgPackProtocol::quantizeX(v.food->pos().x()));
+					o.pack(MsgPackProtocol::quantizeY(v.food->pos().y()));
+					o.pack(v.food->getValue());
+					return o;
+				}
+			};
+
+			template <> struct pack<MsgPackProtocol::CompactFoodDecayMessage>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::CompactFoodDecayMessage const& v) const
+				{
+					o.pack_array(4);
+					o.pack(MsgPackProtocol::COMPACT_PROTOCOL_VERSION);
+					o.pack(static_cast<int>(MsgPackProtocol::MESSAGE_TYPE_FOOD_DECAY));
+					o.pack(v.food_id_deltas.getBaseGuid());
+					o.pack(v.food_id_deltas);
+					return o;
+				}
+			};
+
+			template <> struct pack<MsgPackProtocol::CompactBotMoveMessage>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::CompactBotMoveMessage const& v) const
+				{
+					o.pack_array(4);
+					o.pack(MsgPackProtocol::COMPACT_PROTOCOL_VERSION);
+					o.pack(static_cast<int>(MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE));
+					o.pack(v.items.getBaseGuid());
+					o.pack(v.items);
+					return o;
+				}
+			};
+
+			template <> struct pack<MsgPackProtocol::CompactBotMoveItem>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::CompactBotMoveItem const& v) const
+				{
+					o.pack_array(4);
+					o.pack(v.bot_id_delta);
+
+					o.pack_bin(static_cast<uint32_t>(4 * v.new_segment_count));
+					for (std::size_t i = 0; i < v.new_segment_count; i++)
+					{
+						const Vector2D &pos = (*v.segments)[i].pos();
+						uint16_t xy[2] = {
+							htons(MsgPackProtocol::quantizeX(pos.x())),
+							htons(MsgPackProtocol::quantizeY(pos.y()))
+						};
+						o.pack_bin_body(reinterpret_cast<const char*>(xy), sizeof(xy));
+					}
+
+					o.pack(v.current_length);
+					o.pack(v.current_segment_radius);
+					return o;
+				}
+			};
+
+			template <> struct pack<MsgPackProtocol::CompactBotMoveHeadMessage>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::CompactBotMoveHeadMessage const& v) const
+				{
+					o.pack_array(4);
+					o.pack(MsgPackProtocol::COMPACT_PROTOCOL_VERSION);
+					o.pack(static_cast<int>(MsgPackProtocol::MESSAGE_TYPE_BOT_MOVE_HEAD));
+					o.pack(v.items.getBaseGuid());
+					o.pack(v.items);
+					return o;
+				}
+			};
+
+			template <> struct pack<MsgPackProtocol::CompactBotMoveHeadItem>
+			{
+				template <typename Stream> msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, MsgPackProtocol::CompactBotMoveHeadItem const& v) const
+				{
+					const Snake::PositionList &positions = *v.new_head_positions;
+
+					o.pack_array(5);
+					o.pack(v.bot_id_delta);
+					o.pack(static_cast<float>(v.mass));
+
+					if (positions.empty())
+					{
+						o.pack_nil();
+						o.pack_nil();
+						o.pack_bin(0);
+						return o;
+					}
+
+					// head positions are not wrapped yet, quantize() takes care of that
+					o.pack(MsgPackProtocol::quantizeX(positions[0].x()));
+					o.pack(MsgPackProtocol::quantizeY(positions[0].y()));
+
+					o.pack_bin(static_cast<uint32_t>(2 * (positions.size() - 1)));
+					for (std::size_t i = 1; i < positions.size(); i++)
+					{
+						Vector2D step = positions[i] - positions[i-1];
+						uint16_t heading = htons(MsgPackProtocol::quantizeAngle(std::atan2(step.y(), step.x())));
+						o.pack_bin_body(reinterpret_cast<const char*>(&heading), sizeof(heading));
+					}
+					return o;
+				}
+			};
+
+			template<>
+				struct convert<MsgPackProtocol::ClientProtocolVersionMessage> {
+					msgpack::object const& operator()(msgpack::object const& o, MsgPackProtocol::ClientProtocolVersionMessage& v) const {
+						if (o.type != msgpack::type::ARRAY) throw msgpack::type_error();
+						if (o.via.array.size != 3) throw msgpack::type_error();
+						v.protocol_version = o.via.array.ptr[2].as<uint8_t>();
+						return o;
+					}
+				};
+
+			template<>
+				struct convert<MsgPackProtocol::ClientCompressionMessage> {
+					msgpack::object const& operator()(msgpack::object const& o, MsgPackProtocol::ClientCompressionMessage& v) const {
+						if (o.type != msgpack::type::ARRAY) throw msgpack::type_error();
+						if (o.via.array.size != 3) throw msgpack::type_error();
+						v.method = o.via.array.ptr[2].as<uint8_t>();
+						return o;
+					}
+				};
+
+			template<>
+				struct convert<MsgPackProtocol::ClientViewportMessage> {
+					msgpack::object const& operator()(msgpack::object const& o, MsgPackProtocol::ClientViewportMessage& v) const {
+						if (o.type != msgpack::type::ARRAY) throw msgpack::type_error();
+						if (o.via.array.size == 2)
+						{
+							v = MsgPackProtocol::ClientViewportMessage{};
+							return o;
+						}
+						if (o.via.array.size != 6) throw msgpack::type_error();
+						v.has_rect = true;
+						v.left = o.via.array.ptr[2].as<real_t>();
+						v.top = o.via.array.ptr[3].as<real_t>();
+						v.width = o.via.array.ptr[4].as<real_t>();
+						v.height = o.via.array.ptr[5].as<real_t>();
+						return o;
+					}
+				};
+
+			template<>
+				struct convert<MsgPackProtocol::ClientReplayMessage> {
+					msgpack::object const& operator()(msgpack::object const& o, MsgPackProtocol::ClientReplayMessage& v) const {
+						if (o.type != msgpack::type::ARRAY) throw msgpack::type_error();
+						if (o.via.array.size == 2)
+						{
+							v = MsgPackProtocol::ClientReplayMessage{};
+							return o;
+						}
+						if (o.via.array.size != 3) throw msgpack::type_error();
+						v.has_frame = true;
+						v.frame = o.via.array.ptr[2].as<uint32_t>();
+						return o;
+					}
+				};
+
 			template<>
 				struct convert<Snake::Segment> {
 					msgpack::object const& operator()(msgpack::object const& o, Snake::Segment& v) const {
@@ -16,46 +16,252 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <iterator>
 
 #include "Bot.h"
+#include "BotThreadPool.h"
 #include "Food.h"
 
 #include "config.h"
 
 #include "MsgPackUpdateTracker.h"
 
+static std::atomic<uint64_t> nextInstanceId(1);
+
 /* Private methods */
 
-void MsgPackUpdateTracker::appendMessage(const msgpack::sbuffer &buf)
+template <class T> void MsgPackUpdateTracker::appendMessage(const T &msg, FrameBuilder &frame)
+{
+	frame.beginMessage();
+	msgpack::pack(frame, msg);
+	frame.endMessage();
+}
+
+template <class T> void MsgPackUpdateTracker::appendMessage(const T &msg)
+{
+	appendMessage(msg, m_globalMessages);
+}
+
+template <class T> void MsgPackUpdateTracker::addItem(MsgPackProtocol::PackedItemList &list,
+		const T &item, const viewport::TileSet &tiles)
+{
+	if (m_viewportFilterEnabled)
+	{
+		list.add(item, tiles);
+	}
+	else
+	{
+		list.add(item);
+	}
+}
+
+void MsgPackUpdateTracker::setFilter(const viewport::TileSet *tiles)
+{
+	m_foodConsumeMessage->items.setFilter(tiles);
+	m_foodSpawnMessage->new_food.setFilter(tiles);
+	m_foodDecayMessage->food_ids.setFilter(tiles);
+	m_botMoveMessage->items.setFilter(tiles);
+	m_botMoveHeadMessage->items.setFilter(tiles);
+
+	m_compactFoodSpawnMessage->items.setFilter(tiles);
+	m_compactFoodDecayMessage->food_id_deltas.setFilter(tiles);
+	m_compactBotMoveMessage->items.setFilter(tiles);
+	m_compactBotMoveHeadMessage->items.setFilter(tiles);
+}
+
+MsgPackUpdateTracker::EventBuffer* MsgPackUpdateTracker::threadBuffer(void)
+{
+	std::thread::id thread = std::this_thread::get_id();
+	if (thread == m_ownerThread)
+	{
+		return nullptr;
+	}
+
+	// a worker thread usually tracks events for one tracker only
+	thread_local uint64_t cachedInstanceId = 0;
+	thread_local EventBuffer *cachedBuffer = nullptr;
+	if (cachedInstanceId == m_instanceId)
+	{
+		return cachedBuffer;
+	}
+
+	std::lock_guard<std::mutex> lock(m_eventBuffersMutex);
+
+	auto it = std::find_if(m_eventBuffers.begin(), m_eventBuffers.end(),
+		[thread](const std::unique_ptr<EventBuffer> &buffer) { return buffer->thread == thread; });
+
+	if (it == m_eventBuffers.end())
+	{
+		m_eventBuffers.push_back(std::make_unique<EventBuffer>());
+		m_eventBuffers.back()->thread = thread;
+		it = m_eventBuffers.end() - 1;
+	}
+
+	cachedInstanceId = m_instanceId;
+	cachedBuffer = it->get();
+	return cachedBuffer;
+}
+
+template <class T, class F> void MsgPackUpdateTracker::mergeItems(std::vector< BufferedItem<T> > EventBuffer::*list, F add)
 {
-	uint32_t length = htonl(static_cast<uint32_t>(buf.size()));
+	std::vector< BufferedItem<T> > items;
+	for (auto &buffer: m_eventBuffers)
+	{
+		auto &bufferedItems = (*buffer).*list;
+		std::move(bufferedItems.begin(), bufferedItems.end(), std::back_inserter(items));
+		bufferedItems.clear();
+	}
+
+	// the buffers are in the order their threads started, but all items of
+	// one bot come from the same buffer, and the stable sort keeps their order
+	std::stable_sort(items.begin(), items.end(),
+		[](const BufferedItem<T> &a, const BufferedItem<T> &b) { return a.order < b.order; });
+
+	for (auto &item: items)
+	{
+		add(item);
+	}
+}
+
+static viewport::TileSet tilesOf(const Food &food)
+{
+	viewport::TileSet tiles;
+	tiles.set(viewport::tileIndex(food.pos()));
+	return tiles;
+}
+
+static viewport::TileSet tilesOf(const Snake::SegmentList &segments)
+{
+	viewport::TileSet tiles;
+	for (auto &segment: segments)
+	{
+		tiles.set(viewport::tileIndex(segment.pos()));
+	}
+	return tiles;
+}
+
+void MsgPackUpdateTracker::addFoodConsumed(const MsgPackProtocol::FoodConsumeItem &item,
+		const viewport::TileSet &tiles)
+{
+	addItem(m_foodConsumeMessage->items, item, tiles);
+}
+
+void MsgPackUpdateTracker::addFoodDecayed(guid_t foodId, const viewport::TileSet &tiles)
+{
+	addItem(m_foodDecayMessage->food_ids, foodId, tiles);
+
+	if (m_compactEnabled)
+	{
+		auto &ids = m_compactFoodDecayMessage->food_id_deltas;
+		addItem(ids, ids.guidDelta(foodId), tiles);
+	}
+}
 
-	m_stream.write(reinterpret_cast<char*>(&length), sizeof(length));
-	m_stream.write(buf.data(), buf.size());
+void MsgPackUpdateTracker::addFoodSpawned(const Food &food, const viewport::TileSet &tiles)
+{
+	addItem(m_foodSpawnMessage->new_food, food, tiles);
+
+	if (m_compactEnabled)
+	{
+		auto &items = m_compactFoodSpawnMessage->items;
+		addItem(items, MsgPackProtocol::CompactFoodSpawnItem{items.guidDelta(food.getGUID()), &food}, tiles);
+	}
+}
+
+void MsgPackUpdateTracker::addBotMoved(const std::shared_ptr<Bot> &bot, const MsgPackProtocol::BotMoveItem &item,
+		const MsgPackProtocol::BotMoveHeadItem &headItem, const viewport::TileSet &tiles)
+{
+	// bots unknown in the previous frame were spawned or the filter was just
+	// enabled; in both cases all clients know the whole body
+	if (m_viewportFilterEnabled && (m_killedBots.count(item.bot_id) == 0))
+	{
+		m_botTiles[item.bot_id] = tiles;
+
+		auto last = m_lastBotTiles.find(item.bot_id);
+		if (last != m_lastBotTiles.end())
+		{
+			viewport::TileSet entered = tiles & ~last->second;
+			if (entered.any())
+			{
+				m_enteredBots.push_back({bot, entered, last->second});
+			}
+		}
+	}
+
+	addItem(m_botMoveMessage->items, item, tiles);
+	addItem(m_botMoveHeadMessage->items, headItem, tiles);
+
+	if (m_compactEnabled)
+	{
+		auto &compactItems = m_compactBotMoveMessage->items;
+		addItem(compactItems, MsgPackProtocol::CompactBotMoveItem{
+				compactItems.guidDelta(item.bot_id), item.segments, item.new_segment_count,
+				item.current_length, item.current_segment_radius}, tiles);
+
+		auto &compactHeadItems = m_compactBotMoveHeadMessage->items;
+		addItem(compactHeadItems, MsgPackProtocol::CompactBotMoveHeadItem{
+				compactHeadItems.guidDelta(headItem.bot_id), headItem.mass,
+				headItem.new_head_positions}, tiles);
+	}
 }
 
 /* Public methods */
 
 MsgPackUpdateTracker::MsgPackUpdateTracker()
+	: m_instanceId(nextInstanceId++)
+	, m_ownerThread(std::this_thread::get_id())
+	, m_foodConsumeMessage(std::make_unique<MsgPackProtocol::FoodConsumeMessage>())
+	, m_foodSpawnMessage(std::make_unique<MsgPackProtocol::FoodSpawnMessage>())
+	, m_foodDecayMessage(std::make_unique<MsgPackProtocol::FoodDecayMessage>())
+	, m_botMoveMessage(std::make_unique<MsgPackProtocol::BotMoveMessage>())
+	, m_botMoveHeadMessage(std::make_unique<MsgPackProtocol::BotMoveHeadMessage>())
+	, m_botStatsMessage(std::make_unique<MsgPackProtocol::BotStatsMessage>())
+	, m_botLogMessage(std::make_unique<MsgPackProtocol::BotLogMessage>())
+	, m_compactFoodSpawnMessage(std::make_unique<MsgPackProtocol::CompactFoodSpawnMessage>())
+	, m_compactFoodDecayMessage(std::make_unique<MsgPackProtocol::CompactFoodDecayMessage>())
+	, m_compactBotMoveMessage(std::make_unique<MsgPackProtocol::CompactBotMoveMessage>())
+	, m_compactBotMoveHeadMessage(std::make_unique<MsgPackProtocol::CompactBotMoveHeadMessage>())
 {
-	reset();
 }
 
 void MsgPackUpdateTracker::foodConsumed(const Food &food,
 		const std::shared_ptr<Bot> &by_bot)
 {
-	m_foodConsumeMessage->items.push_back({food.getGUID(), by_bot->getGUID()});
+	MsgPackProtocol::FoodConsumeItem item{food.getGUID(), by_bot->getGUID()};
+
+	if (EventBuffer *buffer = threadBuffer())
+	{
+		buffer->consumedFood.push_back({item.bot_id, item, tilesOf(food)});
+		return;
+	}
+
+	addFoodConsumed(item, tilesOf(food));
 }
 
 void MsgPackUpdateTracker::foodDecayed(const Food &food)
 {
-	m_foodDecayMessage->food_ids.push_back(food.getGUID());
+	if (EventBuffer *buffer = threadBuffer())
+	{
+		buffer->decayedFood.push_back({food.getGUID(), food.getGUID(), tilesOf(food)});
+		return;
+	}
+
+	addFoodDecayed(food.getGUID(), tilesOf(food));
 }
 
 void MsgPackUpdateTracker::foodSpawned(const Food &food)
 {
-	m_foodSpawnMessage->new_food.push_back(food);
+	// buffered as a copy, the food map may reallocate until the merge
+	if (EventBuffer *buffer = threadBuffer())
+	{
+		buffer->spawnedFood.push_back({food.getGUID(), food, tilesOf(food)});
+		return;
+	}
+
+	addFoodSpawned(food, tilesOf(food));
 }
 
 void MsgPackUpdateTracker::botSpawned(const std::shared_ptr<Bot> &bot)
@@ -63,9 +269,7 @@ void MsgPackUpdateTracker::botSpawned(const std::shared_ptr<Bot> &bot)
 	MsgPackProtocol::BotSpawnMessage msg;
 	msg.bot = bot;
 
-	msgpack::sbuffer buf;
-	msgpack::pack(buf, msg);
-	appendMessage(buf);
+	appendMessage(msg);
 }
 
 void MsgPackUpdateTracker::botKilled(
@@ -76,9 +280,17 @@ void MsgPackUpdateTracker::botKilled(
 	msg.killer_id = killer->getGUID();
 	msg.victim_id = victim->getGUID();
 
-	msgpack::sbuffer buf;
-	msgpack::pack(buf, msg);
-	appendMessage(buf);
+	appendMessage(msg);
+
+	if (m_viewportFilterEnabled)
+	{
+		m_killedBots.insert(msg.victim_id);
+		m_botTiles.erase(msg.victim_id);
+		m_enteredBots.erase(
+			std::remove_if(m_enteredBots.begin(), m_enteredBots.end(),
+				[&msg](const EnteredBot &entered) { return entered.bot->getGUID() == msg.victim_id; }),
+			m_enteredBots.end());
+	}
 
 	if (msg.killer_id == msg.victim_id)
 	{
@@ -93,30 +305,51 @@ void MsgPackUpdateTracker::botKilled(
 
 void MsgPackUpdateTracker::botMoved(const std::shared_ptr<Bot> &bot, std::size_t steps)
 {
+	// the items are packed right away, directly from the snake's data; a
+	// buffered item refers to the same data, so the caller merges the buffers
+	// before the snake changes again (see mergeEventBuffers())
+
 	// Fill BotMoveMessage
 	MsgPackProtocol::BotMoveItem item;
 
 	const Snake::SegmentList &segments = bot->getSnake()->getSegments();
 
+	viewport::TileSet tiles;
+	if (m_viewportFilterEnabled)
+	{
+		tiles = tilesOf(segments);
+	}
+
 	item.bot_id = bot->getGUID();
-	item.new_segments.assign(segments.begin(), segments.begin() + steps);
+	item.segments = &segments;
+	item.new_segment_count = steps;
 	item.current_segment_radius = bot->getSnake()->getSegmentRadius();
 	item.current_length = segments.size();
 
-	m_botMoveMessage->items.push_back(item);
-
 	// Fill BotMoveHeadMessage
 	MsgPackProtocol::BotMoveHeadItem headItem;
 
 	headItem.bot_id = bot->getGUID();
 	headItem.mass = bot->getSnake()->getMass();
-	headItem.new_head_positions = bot->getSnake()->getHeadPositionsDuringLastMove();
+	headItem.new_head_positions = &bot->getSnake()->getHeadPositionsDuringLastMove();
+
+	if (EventBuffer *buffer = threadBuffer())
+	{
+		buffer->movedBots.push_back({item.bot_id, {bot, item, headItem}, tiles});
+		return;
+	}
 
-	m_botMoveHeadMessage->items.push_back(headItem);
+	addBotMoved(bot, item, headItem, tiles);
 }
 
 void MsgPackUpdateTracker::botLogMessage(uint64_t viewerKey, const std::string& message)
 {
+	if (EventBuffer *buffer = threadBuffer())
+	{
+		buffer->logMessages.push_back({viewerKey, {viewerKey, message}, {}});
+		return;
+	}
+
 	m_botLogMessage->items.push_back({viewerKey, message});
 }
 
@@ -133,35 +366,31 @@ void MsgPackUpdateTracker::gameInfo(void)
 	msg.snake_segment_distance_exponent = config::SNAKE_SEGMENT_DISTANCE_EXPONENT;
 	msg.snake_pull_factor               = config::SNAKE_PULL_FACTOR;
 
-	msgpack::sbuffer buf;
-	msgpack::pack(buf, msg);
-	appendMessage(buf);
+	appendMessage(msg);
+}
+
+void MsgPackUpdateTracker::streamCompression(uint8_t method)
+{
+	MsgPackProtocol::StreamCompressionMessage msg;
+	msg.method = method;
+	appendMessage(msg);
 }
 
 void MsgPackUpdateTracker::worldState(Field& field)
 {
 	MsgPackProtocol::WorldUpdateMessage msg;
 
-	msg.bots = field.getBots();
+	msg.bots = &field.getBots();
+	msg.food = &field.getFoodMap();
 
-	msg.food.reserve(1024);
-	for (auto& food: field.getFoodMap()) // TODO directly serialize FoodMap
-	{
-		msg.food.push_back(food);
-	}
-
-	msgpack::sbuffer buf;
-	msgpack::pack(buf, msg);
-	appendMessage(buf);
+	appendMessage(msg);
 }
 
 void MsgPackUpdateTracker::tick(uint64_t frame_id)
 {
 	MsgPackProtocol::TickMessage msg;
 	msg.frame_id = frame_id;
-	msgpack::sbuffer buf;
-	msgpack::pack(buf, msg);
-	appendMessage(buf);
+	appendMessage(msg);
 }
 
 void MsgPackUpdateTracker::botStats(const std::shared_ptr<Bot> &bot)
@@ -174,75 +403,178 @@ void MsgPackUpdateTracker::botStats(const std::shared_ptr<Bot> &bot)
 	item.hunted_food_consumed = bot->getConsumedFoodHuntedBySelf();
 	item.mass = bot->getSnake()->getMass();
 
+	if (EventBuffer *buffer = threadBuffer())
+	{
+		buffer->botStats.push_back({item.bot_id, item, {}});
+		return;
+	}
+
 	m_botStatsMessage->items.push_back(item);
 }
 
-std::string MsgPackUpdateTracker::serialize(void)
+void MsgPackUpdateTracker::mergeEventBuffers(void)
 {
-	// decayed food
-	if(!m_foodDecayMessage->food_ids.empty()) {
-		msgpack::sbuffer buf;
-		msgpack::pack(buf, m_foodDecayMessage);
-		appendMessage(buf);
-	}
+	std::lock_guard<std::mutex> lock(m_eventBuffersMutex);
 
-	// spawned food
-	if(!m_foodSpawnMessage->new_food.empty()) {
-		msgpack::sbuffer buf;
-		msgpack::pack(buf, m_foodSpawnMessage);
-		appendMessage(buf);
-	}
+	mergeItems(&EventBuffer::consumedFood, [this](const BufferedItem<MsgPackProtocol::FoodConsumeItem> &i) {
+			addFoodConsumed(i.item, i.tiles);
+		});
 
-	// consumed food
-	if(!m_foodConsumeMessage->items.empty()) {
-		msgpack::sbuffer buf;
-		msgpack::pack(buf, m_foodConsumeMessage);
-		appendMessage(buf);
+	mergeItems(&EventBuffer::decayedFood, [this](const BufferedItem<guid_t> &i) {
+			addFoodDecayed(i.item, i.tiles);
+		});
+
+	mergeItems(&EventBuffer::spawnedFood, [this](const BufferedItem<Food> &i) {
+			addFoodSpawned(i.item, i.tiles);
+		});
+
+	mergeItems(&EventBuffer::movedBots, [this](const BufferedItem<BufferedMove> &i) {
+			addBotMoved(i.item.bot, i.item.item, i.item.headItem, i.tiles);
+		});
+
+	mergeItems(&EventBuffer::botStats, [this](const BufferedItem<MsgPackProtocol::BotStatsItem> &i) {
+			m_botStatsMessage->items.push_back(i.item);
+		});
+
+	mergeItems(&EventBuffer::logMessages, [this](const BufferedItem<MsgPackProtocol::BotLogItem> &i) {
+			m_botLogMessage->items.push_back(i.item);
+		});
+}
+
+SharedBuffer MsgPackUpdateTracker::serialize(void)
+{
+	return serialize(false, nullptr);
+}
+
+SharedBuffer MsgPackUpdateTracker::serialize(bool compact, const viewport::TileSet *tiles)
+{
+	// buffers that are still being filled cannot be merged
+	assert(!BotThreadPool::isAnyJobRunning());
+	mergeEventBuffers();
+
+	if ((compact && !m_compactEnabled) || ((tiles != nullptr) && !m_viewportFilterEnabled))
+	{
+		return nullptr;
 	}
 
-	// moved bots
-	if(!m_botMoveMessage->items.empty()) {
-		msgpack::sbuffer buf;
-		msgpack::pack(buf, m_botMoveMessage);
-		appendMessage(buf);
+	// single messages (spawns, kills, ...) in the order they happened
+	m_frame.write(m_globalMessages.data(), m_globalMessages.size());
+
+	setFilter(tiles);
+
+	if (!compact)
+	{
+		// decayed food
+		if(!m_foodDecayMessage->food_ids.empty()) {
+			appendMessage(*m_foodDecayMessage, m_frame);
+		}
+
+		// spawned food
+		if(!m_foodSpawnMessage->new_food.empty()) {
+			appendMessage(*m_foodSpawnMessage, m_frame);
+		}
+
+		// consumed food
+		if(!m_foodConsumeMessage->items.empty()) {
+			appendMessage(*m_foodConsumeMessage, m_frame);
+		}
+
+		// moved bots
+		if(!m_botMoveMessage->items.empty()) {
+			appendMessage(*m_botMoveMessage, m_frame);
+		}
+
+		// moved bots (compressed version)
+		if(!m_botMoveHeadMessage->items.empty()) {
+			appendMessage(*m_botMoveHeadMessage, m_frame);
+		}
+	}
+	else
+	{
+		// same order as above
+		if(!m_compactFoodDecayMessage->food_id_deltas.empty()) {
+			appendMessage(*m_compactFoodDecayMessage, m_frame);
+		}
+
+		if(!m_compactFoodSpawnMessage->items.empty()) {
+			appendMessage(*m_compactFoodSpawnMessage, m_frame);
+		}
+
+		if(!m_foodConsumeMessage->items.empty()) {
+			appendMessage(*m_foodConsumeMessage, m_frame);
+		}
+
+		if(!m_compactBotMoveMessage->items.empty()) {
+			appendMessage(*m_compactBotMoveMessage, m_frame);
+		}
+
+		if(!m_compactBotMoveHeadMessage->items.empty()) {
+			appendMessage(*m_compactBotMoveHeadMessage, m_frame);
+		}
 	}
 
-	// moved bots (compressed version)
-	if(!m_botMoveHeadMessage->items.empty()) {
-		msgpack::sbuffer buf;
-		msgpack::pack(buf, m_botMoveHeadMessage);
-		appendMessage(buf);
+	// full bodies of bots that just became visible, after their moves so
+	// they replace the outdated bodies; bots that were visible before are
+	// known already
+	if (tiles != nullptr)
+	{
+		for (auto &entered: m_enteredBots)
+		{
+			if ((entered.lastTiles & *tiles).none() && (entered.tiles & *tiles).any())
+			{
+				MsgPackProtocol::BotSpawnMessage msg;
+				msg.bot = entered.bot;
+				appendMessage(msg, m_frame);
+			}
+		}
 	}
 
+	setFilter(nullptr);
+
 	// bot statistics
 	if(!m_botStatsMessage->items.empty()) {
-		msgpack::sbuffer buf;
-		msgpack::pack(buf, m_botStatsMessage);
-		appendMessage(buf);
+		appendMessage(*m_botStatsMessage, m_frame);
 	}
 
 	// log messages
 	if (!m_botLogMessage->items.empty()) {
-		msgpack::sbuffer buf;
-		msgpack::pack(buf, m_botLogMessage);
-		appendMessage(buf);
+		appendMessage(*m_botLogMessage, m_frame);
 	}
 
-	std::string result = m_stream.str();
-	reset();
-	return result;
+	return m_frame.finish();
 }
 
 void MsgPackUpdateTracker::reset(void)
 {
-	m_foodConsumeMessage = std::make_unique<MsgPackProtocol::FoodConsumeMessage>();
-	m_foodSpawnMessage = std::make_unique<MsgPackProtocol::FoodSpawnMessage>();
-	m_foodDecayMessage = std::make_unique<MsgPackProtocol::FoodDecayMessage>();
-	m_botMoveMessage = std::make_unique<MsgPackProtocol::BotMoveMessage>();
-	m_botMoveHeadMessage = std::make_unique<MsgPackProtocol::BotMoveHeadMessage>();
-	m_botStatsMessage = std::make_unique<MsgPackProtocol::BotStatsMessage>();
-	m_botLogMessage = std::make_unique<MsgPackProtocol::BotLogMessage>();
-
-	m_stream.str("");
+	// clear instead of reallocating, so the capacity is kept for the next frame
+	m_foodConsumeMessage->items.clear();
+	m_foodSpawnMessage->new_food.clear();
+	m_foodDecayMessage->food_ids.clear();
+	m_botMoveMessage->items.clear();
+	m_botMoveHeadMessage->items.clear();
+	m_botStatsMessage->items.clear();
+	m_botLogMessage->items.clear();
+
+	m_compactFoodSpawnMessage->items.clear();
+	m_compactFoodDecayMessage->food_id_deltas.clear();
+	m_compactBotMoveMessage->items.clear();
+	m_compactBotMoveHeadMessage->items.clear();
+
+	m_globalMessages.clear();
+	m_frame.clear();
+
+	std::swap(m_lastBotTiles, m_botTiles);
+	m_botTiles.clear();
+	m_killedBots.clear();
+	m_enteredBots.clear();
+
+	// only switch between frames
+	m_compactEnabled = m_compactRequested;
+	m_viewportFilterEnabled = m_viewportFilterRequested;
+
+	if (!m_viewportFilterEnabled)
+	{
+		m_lastBotTiles.clear();
+	}
 }
 
@@ -18,22 +18,70 @@
 
 #pragma once
 
-#include <sstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <msgpack.hpp>
 
 #include "MsgPackProtocol.h"
 
 #include "types.h"
+#include "Food.h"
+#include "FrameBuilder.h"
+#include "Viewport.h"
 #include "UpdateTracker.h"
 
 /*!
  * \brief Implementation of UpdateTracker which serializes the events using
  * MsgPack.
+ *
+ * Events tracked on other threads than the one that created the tracker are
+ * stored unpacked in a buffer of that thread, together with the data needed
+ * later (the food, the moved snake). mergeEventBuffers() sorts them by bot or
+ * food GUID and packs them like events of the tracker's own thread.
+ *
+ * A client with a viewport does not get the moves of bots outside of it, so
+ * it does not know their bodies. When a bot outside of a viewport reaches
+ * tiles of it, the filtered variant gets a BotSpawn message for the bot after
+ * the moves, which replaces the whole body.
  */
 class MsgPackUpdateTracker : public UpdateTracker
 {
 	private:
+		template <class T> struct BufferedItem
+		{
+			guid_t order; // GUID of the bot or food, items are merged by it
+			T item;
+			viewport::TileSet tiles;
+		};
+
+		struct BufferedMove
+		{
+			std::shared_ptr<Bot> bot; // keeps the segments alive until merged
+			MsgPackProtocol::BotMoveItem item;
+			MsgPackProtocol::BotMoveHeadItem headItem;
+		};
+
+		struct EventBuffer
+		{
+			std::thread::id thread;
+			std::vector< BufferedItem<MsgPackProtocol::FoodConsumeItem> > consumedFood;
+			std::vector< BufferedItem<guid_t> > decayedFood;
+			std::vector< BufferedItem<Food> > spawnedFood;
+			std::vector< BufferedItem<BufferedMove> > movedBots;
+			std::vector< BufferedItem<MsgPackProtocol::BotStatsItem> > botStats;
+			std::vector< BufferedItem<MsgPackProtocol::BotLogItem> > logMessages;
+		};
+
+		uint64_t m_instanceId; // identifies the tracker in the threads' buffer cache
+		std::thread::id m_ownerThread;
+		std::mutex m_eventBuffersMutex;
+		std::vector< std::unique_ptr<EventBuffer> > m_eventBuffers;
+
 		// messages that need to be filled over a frame
 		std::unique_ptr<MsgPackProtocol::FoodConsumeMessage> m_foodConsumeMessage;
 		std::unique_ptr<MsgPackProtocol::FoodSpawnMessage> m_foodSpawnMessage;
@@ -43,9 +91,56 @@ class MsgPackUpdateTracker : public UpdateTracker
 		std::unique_ptr<MsgPackProtocol::BotStatsMessage> m_botStatsMessage;
 		std::unique_ptr<MsgPackProtocol::BotLogMessage> m_botLogMessage;
 
-		std::ostringstream m_stream;
+		// compact versions of the above, only filled if enabled
+		std::unique_ptr<MsgPackProtocol::CompactFoodSpawnMessage> m_compactFoodSpawnMessage;
+		std::unique_ptr<MsgPackProtocol::CompactFoodDecayMessage> m_compactFoodDecayMessage;
+		std::unique_ptr<MsgPackProtocol::CompactBotMoveMessage> m_compactBotMoveMessage;
+		std::unique_ptr<MsgPackProtocol::CompactBotMoveHeadMessage> m_compactBotMoveHeadMessage;
+
+		// messages that are sent unchanged in all variants of a frame
+		FrameBuilder m_globalMessages;
+
+		struct EnteredBot
+		{
+			std::shared_ptr<Bot> bot;
+			viewport::TileSet tiles; // tiles the bot did not touch in the previous frame
+			viewport::TileSet lastTiles; // tiles the bot touched in the previous frame
+		};
+
+		// viewport tracking, only filled while the viewport filter is enabled
+		std::unordered_map<guid_t, viewport::TileSet> m_botTiles;
+		std::unordered_map<guid_t, viewport::TileSet> m_lastBotTiles;
+		std::unordered_set<guid_t> m_killedBots;
+		std::vector<EnteredBot> m_enteredBots;
+
+		FrameBuilder m_frame;
+
+		bool m_compactEnabled = false;
+		bool m_compactRequested = false;
+		bool m_viewportFilterEnabled = false;
+		bool m_viewportFilterRequested = false;
+
+		template <class T> void appendMessage(const T &msg);
+		template <class T> void appendMessage(const T &msg, FrameBuilder &frame);
 
-		void appendMessage(const msgpack::sbuffer &buf);
+		template <class T> void addItem(MsgPackProtocol::PackedItemList &list,
+				const T &item, const viewport::TileSet &tiles);
+
+		void setFilter(const viewport::TileSet *tiles);
+
+		/*!
+		 * \returns   The buffer of the calling thread, or nullptr if it is
+		 *            the thread that created the tracker.
+		 */
+		EventBuffer* threadBuffer(void);
+
+		template <class T, class F> void mergeItems(std::vector< BufferedItem<T> > EventBuffer::*list, F add);
+
+		void addFoodConsumed(const MsgPackProtocol::FoodConsumeItem &item, const viewport::TileSet &tiles);
+		void addFoodDecayed(guid_t foodId, const viewport::TileSet &tiles);
+		void addFoodSpawned(const Food &food, const viewport::TileSet &tiles);
+		void addBotMoved(const std::shared_ptr<Bot> &bot, const MsgPackProtocol::BotMoveItem &item,
+				const MsgPackProtocol::BotMoveHeadItem &headItem, const viewport::TileSet &tiles);
 
 	public:
 		MsgPackUpdateTracker();
@@ -71,13 +166,48 @@ class MsgPackUpdateTracker : public UpdateTracker
 
 		void gameInfo(void);
 
+		/*!
+		 * Announce that the stream continues with the given compression
+		 * method (see MsgPackProtocol::COMPRESSION_NONE).
+		 */
+		void streamCompression(uint8_t method);
+
 		void worldState(Field &field) override;
 
 		void tick(uint64_t frame_id) override;
 
 		void botStats(const std::shared_ptr<Bot> &bot) override;
 
-		std::string serialize(void) override;
+		void mergeEventBuffers(void) override;
+
+		SharedBuffer serialize(void) override;
+
+		/*!
+		 * Serialize a variant of the current frame. Can be called multiple
+		 * times before reset(). Merges the event buffers first.
+		 *
+		 * \param compact   Use the compact encoding
+		 *                  (MsgPackProtocol::COMPACT_PROTOCOL_VERSION).
+		 * \param tiles     Only include events touching these tiles, or all
+		 *                  events if nullptr.
+		 *
+		 * \returns   The serialized frame, or nullptr if the variant is not
+		 *            enabled for the current frame.
+		 */
+		SharedBuffer serialize(bool compact, const viewport::TileSet *tiles);
 
 		void reset(void) override;
+
+		/*!
+		 * Enable or disable tracking of the data for the compact encoding.
+		 * The change takes effect with the next frame, so a frame is always
+		 * complete in all enabled variants.
+		 */
+		void setCompactEncodingEnabled(bool enable) { m_compactRequested = enable; }
+
+		/*!
+		 * Enable or disable tagging events with their viewport tiles, which
+		 * is required for filtered frames. Takes effect with the next frame.
+		 */
+		void setViewportFilterEnabled(bool enable) { m_viewportFilterRequested = enable; }
 };
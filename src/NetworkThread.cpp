@@ -0,0 +1,336 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <csignal>
+#include <iostream>
+
+#include <pthread.h>
+
+#include "MsgPackUpdateTracker.h"
+#include "NetworkThread.h"
+
+const SharedBuffer& FrameSet::select(const ClientSettings &settings) const
+{
+	bool compact = (settings.protocolVersion == MsgPackProtocol::COMPACT_PROTOCOL_VERSION);
+
+	for (auto &variant: variants)
+	{
+		if ((variant.compact == compact) && (variant.filtered == settings.hasViewport)
+				&& (!variant.filtered || (variant.tiles == settings.viewportTiles)))
+		{
+			return variant.frame;
+		}
+	}
+
+	return frame;
+}
+
+NetworkThread::NetworkThread(const SharedBuffer &gameInfo, std::unique_ptr<FrameCompressor> compressor,
+		const std::string &archiveDirectory)
+	: m_gameInfo(gameInfo)
+	, m_compressor(std::move(compressor))
+	, m_archiveDirectory(archiveDirectory)
+{
+	MsgPackUpdateTracker onTracker;
+	onTracker.streamCompression(MsgPackProtocol::COMPRESSION_ZSTD);
+	m_compressionOn = onTracker.serialize();
+
+	MsgPackUpdateTracker offTracker;
+	offTracker.streamCompression(MsgPackProtocol::COMPRESSION_NONE);
+	m_compressionOff = offTracker.serialize();
+
+	m_thread = std::thread([this]() { run(); });
+}
+
+NetworkThread::~NetworkThread()
+{
+	post(Event());
+	m_thread.join();
+}
+
+void NetworkThread::post(Event &&event)
+{
+	// only blocks if the network thread is seconds behind
+	while (!m_queue.push(std::move(event)))
+	{
+		std::this_thread::yield();
+	}
+
+	m_eventsAvailable.post();
+}
+
+void NetworkThread::addClient(const std::shared_ptr<ClientConnection> &client, const SharedBuffer &worldState)
+{
+	Event event;
+	event.type = Event::ClientConnected;
+	event.client = client;
+	event.worldState = worldState;
+	post(std::move(event));
+}
+
+void NetworkThread::updateClient(const std::shared_ptr<ClientConnection> &client,
+		const ClientSettings &settings, bool resync)
+{
+	Event event;
+	event.type = Event::ClientChanged;
+	event.client = client;
+	event.settings = settings;
+	event.resync = resync;
+	post(std::move(event));
+}
+
+void NetworkThread::removeClient(const std::shared_ptr<ClientConnection> &client)
+{
+	Event event;
+	event.type = Event::ClientClosed;
+	event.client = client;
+	post(std::move(event));
+}
+
+void NetworkThread::replayClient(const std::shared_ptr<ClientConnection> &client, bool replay, uint32_t frame)
+{
+	Event event;
+	event.type = Event::ClientReplay;
+	event.client = client;
+	event.replay = replay;
+	event.replayFrame = frame;
+	post(std::move(event));
+}
+
+void NetworkThread::publishFrame(std::shared_ptr<const FrameSet> frameSet)
+{
+	Event event;
+	event.type = Event::Frame;
+	event.frame = std::move(frameSet);
+	post(std::move(event));
+}
+
+void NetworkThread::run(void)
+{
+	Event event;
+
+	// sendfile() has no MSG_NOSIGNAL; a closed connection is reported by
+	// its error instead
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	while (true)
+	{
+		m_eventsAvailable.wait();
+		if (!m_queue.pop(event))
+		{
+			continue;
+		}
+
+		switch (event.type)
+		{
+			case Event::Frame:
+				sendFrame(*event.frame);
+				break;
+
+			case Event::ClientConnected:
+				event.client->send(m_gameInfo);
+				syncClient(*event.client, event.worldState);
+				event.client->flush();
+				m_clients.push_back(event.client);
+				break;
+
+			case Event::ClientChanged:
+				if (m_replays.count(event.client.get()))
+				{
+					// applied when the client returns to the live game
+					event.client->setSettings(event.settings);
+					break;
+				}
+
+				applySettings(*event.client, event.settings);
+				if (event.resync)
+				{
+					syncClient(*event.client, nullptr);
+				}
+				break;
+
+			case Event::ClientReplay:
+				if (event.replay)
+				{
+					startReplay(*event.client, event.replayFrame);
+				}
+				else
+				{
+					auto replay = m_replays.find(event.client.get());
+					if (replay != m_replays.end())
+					{
+						replay->second->stop();
+					}
+				}
+				break;
+
+			case Event::ClientClosed:
+			{
+				auto &client = event.client;
+				if (client->getResyncCount() > 0)
+				{
+					std::cerr << "  " << client->getDroppedFrames() << " frames dropped, "
+						<< client->getResyncCount() << " resyncs." << std::endl;
+				}
+				m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), client), m_clients.end());
+				m_replays.erase(client.get());
+				break;
+			}
+
+			case Event::Stop:
+				return;
+		}
+
+		// release the references while waiting
+		event = Event();
+	}
+}
+
+void NetworkThread::sendFrame(const FrameSet &frameSet)
+{
+	m_history.addFrame(frameSet.frame);
+
+	for (auto &client: m_clients)
+	{
+		auto replay = m_replays.find(client.get());
+		if (replay != m_replays.end())
+		{
+			// paced by the live game: one archived frame per live frame
+			if (!replay->second->sendNext(*client))
+			{
+				stopReplay(*client);
+				client->flush();
+			}
+			continue;
+		}
+
+		if (client->needsResync())
+		{
+			std::cerr << "resynchronizing " << client->getPeer() << " ("
+				<< client->getDroppedFrames() << " frames dropped so far)" << std::endl;
+			syncClient(*client, nullptr);
+		}
+		else
+		{
+			client->send(frameSet.select(client->getSettings()));
+		}
+
+		client->flush();
+	}
+
+	// the next recovery point
+	if (frameSet.keyframe)
+	{
+		m_history.setKeyframe(frameSet.keyframe);
+	}
+
+	if (++m_compressionStatsCounter >= COMPRESSION_STATS_INTERVAL)
+	{
+		printCompressionStats();
+		m_compressionStatsCounter = 0;
+	}
+}
+
+void NetworkThread::syncClient(ClientConnection &client, const SharedBuffer &worldState)
+{
+	if (m_history.hasKeyframe())
+	{
+		client.resync(m_history.getKeyframe(), m_history.getFrames());
+	}
+	else if (worldState)
+	{
+		client.resync(worldState, {});
+	}
+}
+
+void NetworkThread::applySettings(ClientConnection &client, const ClientSettings &settings)
+{
+	client.setSettings(settings);
+
+	bool compress = (settings.compression == MsgPackProtocol::COMPRESSION_ZSTD) && m_compressor;
+	if (compress && !client.isCompressed())
+	{
+		client.setCompression(m_compressor.get(), m_compressionOn);
+	}
+	else if (!compress && client.isCompressed())
+	{
+		client.setCompression(nullptr, m_compressionOff);
+	}
+}
+
+void NetworkThread::startReplay(ClientConnection &client, uint32_t frame)
+{
+	if (m_archiveDirectory.empty())
+	{
+		std::cerr << "replay requested by " << client.getPeer() << ", but there is no archive" << std::endl;
+		return;
+	}
+
+	auto replay = m_replays.find(&client);
+	if (replay != m_replays.end())
+	{
+		replay->second->seek(frame);
+		return;
+	}
+
+	if (!m_archive)
+	{
+		m_archive = std::make_unique<ArchiveLoader>(m_archiveDirectory);
+	}
+
+	// if the frame is not archived, the loader reports it and the client
+	// returns to the live game
+	auto player = std::make_unique<ArchivePlayer>(*m_archive, frame);
+
+	// the archive holds the uncompressed stream
+	if (client.isCompressed())
+	{
+		client.setCompression(nullptr, m_compressionOff);
+	}
+
+	m_replays[&client] = std::move(player);
+}
+
+void NetworkThread::stopReplay(ClientConnection &client)
+{
+	m_replays.erase(&client);
+	std::cerr << client.getPeer() << " returns to the live game" << std::endl;
+
+	// restores the compression and continues with the live game
+	applySettings(client, client.getSettings());
+	syncClient(client, nullptr);
+}
+
+void NetworkThread::printCompressionStats(void)
+{
+	if (!m_compressor || (m_compressor->getCompressedBuffers() == 0))
+	{
+		return;
+	}
+
+	std::cerr << "compression: " << m_compressor->getCompressedBuffers() << " buffers, "
+		<< m_compressor->getInputBytes() << " -> " << m_compressor->getOutputBytes() << " bytes ("
+		<< (100 * m_compressor->getOutputBytes() / m_compressor->getInputBytes()) << "%), "
+		<< (m_compressor->getNanoseconds() / 1000) << " us" << std::endl;
+
+	m_compressor->resetStats();
+}
@@ -0,0 +1,179 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ClientConnection.h"
+#include "FrameCompressor.h"
+#include "FrameHistory.h"
+#include "Semaphore.h"
+#include "SpectatorArchive.h"
+#include "SharedBuffer.h"
+#include "SpscQueue.h"
+#include "Viewport.h"
+
+/*!
+ * \brief All serialized variants of one frame.
+ *
+ * Built by the simulation and never modified after it was published.
+ */
+struct FrameSet
+{
+	struct Variant
+	{
+		bool compact;
+		bool filtered;
+		viewport::TileSet tiles; // only used if filtered
+		SharedBuffer frame;
+	};
+
+	SharedBuffer frame; // default encoding, unfiltered
+	std::vector<Variant> variants;
+
+	SharedBuffer keyframe; // world state after this frame, or nullptr
+
+	/*!
+	 * \returns   The frame for a client with the given settings; the default
+	 *            frame if the matching variant was not serialized.
+	 */
+	const SharedBuffer& select(const ClientSettings &settings) const;
+};
+
+/*!
+ * \brief Sends the update stream to all clients on its own thread.
+ *
+ * The simulation thread only publishes events into a lock-free queue: new
+ * frames, as well as clients that were connected, changed their settings or
+ * disconnected. They are processed in order, so a settings change always
+ * applies from the same frame on.
+ *
+ * The network thread owns the clients' send queues, the frame history used
+ * for resynchronization and the compression of the stream, so none of that
+ * costs time in the simulation tick.
+ */
+class NetworkThread
+{
+	private:
+		// a few seconds of frames, if the network thread falls behind
+		static constexpr const std::size_t QUEUE_SIZE = 1024;
+		static constexpr const int COMPRESSION_STATS_INTERVAL = 600;
+
+		struct Event
+		{
+			enum Type
+			{
+				Frame,
+				ClientConnected,
+				ClientChanged,
+				ClientClosed,
+				ClientReplay,
+				Stop
+			};
+
+			Type type = Stop;
+			std::shared_ptr<const FrameSet> frame;
+
+			std::shared_ptr<ClientConnection> client;
+			ClientSettings settings;
+			bool resync = false;
+			SharedBuffer worldState; // for clients connecting before the first keyframe
+			bool replay = false;
+			uint32_t replayFrame = 0;
+		};
+
+		SpscQueue<Event, QUEUE_SIZE> m_queue;
+		Semaphore m_eventsAvailable;
+
+		// everything below is only used by the network thread
+		std::vector< std::shared_ptr<ClientConnection> > m_clients;
+		FrameHistory m_history;
+		SharedBuffer m_gameInfo;
+
+		std::unique_ptr<FrameCompressor> m_compressor;
+		SharedBuffer m_compressionOn;  // announcements of the stream compression
+		SharedBuffer m_compressionOff;
+		int m_compressionStatsCounter = 0;
+
+		std::string m_archiveDirectory;
+		std::unique_ptr<ArchiveLoader> m_archive; // started on the first replay
+		std::map< ClientConnection*, std::unique_ptr<ArchivePlayer> > m_replays;
+
+		std::thread m_thread;
+
+		void post(Event &&event);
+
+		void run(void);
+		void sendFrame(const FrameSet &frameSet);
+		void syncClient(ClientConnection &client, const SharedBuffer &worldState);
+		void applySettings(ClientConnection &client, const ClientSettings &settings);
+		void startReplay(ClientConnection &client, uint32_t frame);
+		void stopReplay(ClientConnection &client);
+		void printCompressionStats(void);
+
+	public:
+		/*!
+		 * \param gameInfo     Sent first to every client.
+		 * \param compressor   Used for clients requesting compression; may
+		 *                     be nullptr if compression is not available.
+		 * \param archiveDirectory   Spectator archive for replays, or empty.
+		 */
+		NetworkThread(const SharedBuffer &gameInfo, std::unique_ptr<FrameCompressor> compressor,
+				const std::string &archiveDirectory);
+		~NetworkThread();
+
+		NetworkThread(const NetworkThread&) = delete;
+		NetworkThread& operator=(const NetworkThread&) = delete;
+
+		/*!
+		 * Hand a new client over to the network thread, which sends it the
+		 * game info and the current state of the world.
+		 *
+		 * \param worldState   Used only if no keyframe was published yet.
+		 */
+		void addClient(const std::shared_ptr<ClientConnection> &client, const SharedBuffer &worldState);
+
+		/*!
+		 * Apply new settings to a client.
+		 *
+		 * \param resync   The client needs the current state of the world,
+		 *                 e.g. because its viewport grew.
+		 */
+		void updateClient(const std::shared_ptr<ClientConnection> &client,
+				const ClientSettings &settings, bool resync);
+
+		void removeClient(const std::shared_ptr<ClientConnection> &client);
+
+		/*!
+		 * Switch a client to a replay from the archive, or back to the live
+		 * game. The client returns to the live game by itself when the
+		 * replay catches up.
+		 */
+		void replayClient(const std::shared_ptr<ClientConnection> &client, bool replay, uint32_t frame);
+
+		/*!
+		 * Publish a frame. This only queues a pointer; serialization is
+		 * done by the caller, sending by the network thread.
+		 */
+		void publishFrame(std::shared_ptr<const FrameSet> frameSet);
+};
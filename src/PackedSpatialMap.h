@@ -0,0 +1,153 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "types.h"
+
+/*!
+ * Packed, read-only spatial map for region queries.
+ *
+ * The map is filled once per frame with small POD items (which need at least
+ * members x and y). finalize() then sorts them by tile into one contiguous
+ * vector. Afterwards the map is only read, so any number of threads can query
+ * it concurrently without locking.
+ *
+ * Queries report the position of each item relative to the query center. The
+ * torus wrap-around is resolved once per tile instead of once per item.
+ */
+template <class T, size_t TILES_X, size_t TILES_Y> class PackedSpatialMap
+{
+	public:
+		PackedSpatialMap(real_t fieldSizeX, real_t fieldSizeY)
+			: m_fieldSizeX(fieldSizeX)
+			, m_fieldSizeY(fieldSizeY)
+			, m_tileSizeX(fieldSizeX/TILES_X)
+			, m_tileSizeY(fieldSizeY/TILES_Y)
+		{
+			m_tileStart.fill(0);
+		}
+
+		/*!
+		 * Remove all items and start filling the map.
+		 */
+		void clear()
+		{
+			m_staging.clear();
+		}
+
+		void addElement(T item)
+		{
+			// move the item into the unique field area, so that its position
+			// matches the tile it is sorted into
+			item.x -= std::floor(item.x / m_fieldSizeX) * m_fieldSizeX;
+			item.y -= std::floor(item.y / m_fieldSizeY) * m_fieldSizeY;
+			m_staging.push_back(item);
+		}
+
+		/*!
+		 * Sort the items added since the last clear() into their tiles.
+		 */
+		void finalize()
+		{
+			m_tileStart.fill(0);
+			for (auto &item: m_staging)
+			{
+				m_tileStart[getTileIndex(item) + 1]++;
+			}
+
+			for (size_t i = 1; i < m_tileStart.size(); i++)
+			{
+				m_tileStart[i] += m_tileStart[i-1];
+			}
+
+			std::array<uint32_t, TILES_X*TILES_Y> fillPos;
+			std::copy(m_tileStart.begin(), m_tileStart.end()-1, fillPos.begin());
+
+			m_items.resize(m_staging.size());
+			for (auto &item: m_staging)
+			{
+				m_items[fillPos[getTileIndex(item)]++] = item;
+			}
+		}
+
+		size_t size() const
+		{
+			return m_items.size();
+		}
+
+		/*!
+		 * Call func(item, relX, relY) for every item in the tiles touched by
+		 * the square around center. relX/relY is the unwrapped position of the
+		 * item relative to center; filtering by actual distance is up to func.
+		 */
+		template <class Func> void forEachInRegion(const Vector2D& center, real_t radius, Func func) const
+		{
+			const int x1 = static_cast<int>(std::floor((center.x() - radius) / m_tileSizeX));
+			const int y1 = static_cast<int>(std::floor((center.y() - radius) / m_tileSizeY));
+			const int x2 = static_cast<int>(std::floor((center.x() + radius) / m_tileSizeX));
+			const int y2 = static_cast<int>(std::floor((center.y() + radius) / m_tileSizeY));
+
+			for (int tileY = y1; tileY <= y2; tileY++)
+			{
+				const int wrapsY = floorDiv<TILES_Y>(tileY);
+				const size_t rowIndex = static_cast<size_t>(tileY - wrapsY*static_cast<int>(TILES_Y)) * TILES_X;
+				const real_t offsetY = wrapsY*m_fieldSizeY - center.y();
+
+				for (int tileX = x1; tileX <= x2; tileX++)
+				{
+					const int wrapsX = floorDiv<TILES_X>(tileX);
+					const size_t tileIndex = rowIndex + static_cast<size_t>(tileX - wrapsX*static_cast<int>(TILES_X));
+					const real_t offsetX = wrapsX*m_fieldSizeX - center.x();
+
+					const uint32_t end = m_tileStart[tileIndex+1];
+					for (uint32_t i = m_tileStart[tileIndex]; i < end; i++)
+					{
+						const T& item = m_items[i];
+						func(item, item.x + offsetX, item.y + offsetY);
+					}
+				}
+			}
+		}
+
+	private:
+		real_t m_fieldSizeX, m_fieldSizeY;
+		real_t m_tileSizeX, m_tileSizeY;
+
+		std::vector<T> m_staging;
+		std::vector<T> m_items;
+		std::array<uint32_t, TILES_X*TILES_Y+1> m_tileStart; //!< index of the first item of each tile in m_items
+
+		size_t getTileIndex(const T& item) const
+		{
+			size_t tileX = std::min(static_cast<size_t>(item.x / m_tileSizeX), TILES_X-1);
+			size_t tileY = std::min(static_cast<size_t>(item.y / m_tileSizeY), TILES_Y-1);
+			return tileY*TILES_X + tileX;
+		}
+
+		template <size_t SIZE> static int floorDiv(int value)
+		{
+			int result = value / static_cast<int>(SIZE);
+			if ((value % static_cast<int>(SIZE)) < 0) { result--; }
+			return result;
+		}
+};
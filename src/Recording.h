@@ -0,0 +1,96 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "types.h"
+
+/*!
+ * \brief File format of game recordings.
+ *
+ * A recording consists of two append-only files:
+ *
+ * - The log starts with a Header, followed by blocks. Each block is a
+ *   BlockHeader and its payload, padded to a multiple of 8 bytes. The
+ *   update and world state blocks contain the serialized messages exactly
+ *   as they are sent to the clients, so they can be streamed to viewers
+ *   without decoding them.
+ * - The index (log file name + INDEX_SUFFIX) has one IndexEntry per
+ *   recorded frame, pointing to the blocks of that frame. The game info
+ *   block directly follows the header and is not indexed.
+ *
+ * Both files use native byte order and fixed-size records and are meant to
+ * be mapped into memory for reading. An index entry is only appended after
+ * the blocks of its frame were written; anything in the log behind the last
+ * indexed frame is incomplete. Frame numbers start again when the server is
+ * restarted without a checkpoint, so the index is ordered by recording time
+ * and not necessarily by frame number.
+ */
+namespace Recording
+{
+	static constexpr const char* INDEX_SUFFIX = ".idx";
+	static constexpr const uint32_t FORMAT_VERSION = 1;
+
+	enum BlockType : uint32_t {
+		BLOCK_GAME_INFO   = 1, //!< game info message, once at the beginning of the log
+		BLOCK_WORLD_STATE = 2, //!< complete world state after the frame, at keyframes
+		BLOCK_UPDATE      = 3, //!< all update messages of a frame
+		BLOCK_BOT_INPUTS  = 4, //!< BotInput records of a frame
+	};
+
+	enum IndexFlags : uint32_t {
+		INDEX_KEYFRAME  = 1, //!< the frame ends with a world state block; a replay can start after it
+		INDEX_AFTER_GAP = 2, //!< frames before this one were dropped or the server was restarted
+	};
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+	};
+
+	struct BlockHeader
+	{
+		uint32_t type;
+		uint32_t frame;
+		uint64_t size; //!< payload size without padding
+	};
+
+	struct IndexEntry
+	{
+		uint32_t frame;
+		uint32_t flags;
+		uint64_t offset; //!< offset of the first block of the frame in the log
+		uint64_t size;   //!< size of all blocks of the frame
+	};
+
+	/*!
+	 * Steering decision of a bot's script in one frame.
+	 */
+	struct BotInput
+	{
+		guid_t guid;
+		int32_t databaseId;
+		real_t directionChange;
+		uint32_t boost;
+		uint32_t reserved;
+	};
+}
@@ -229,3 +229,37 @@ real_t Snake::getConsumeRadius()
 {
 	return m_segmentRadius * config::SNAKE_CONSUME_RANGE;
 }
+
+void Snake::saveState(Checkpoint::BotRecord &record, std::vector<Checkpoint::SegmentRecord> &segments) const
+{
+	record.firstSegment = segments.size();
+	record.segmentCount = m_segments.size();
+	record.mass = m_mass;
+	record.heading = m_heading;
+	record.movedSinceLastSpawn = m_movedSinceLastSpawn;
+	record.foodToDrop = m_foodToDrop;
+	record.boostedLastMove = (m_boostedLastMove != 0);
+
+	for (auto &s: m_segments)
+	{
+		segments.push_back({s.pos().x(), s.pos().y()});
+	}
+}
+
+void Snake::restoreState(const Checkpoint::BotRecord &record, const Checkpoint::SegmentRecord *segments)
+{
+	m_segments.clear();
+	for (std::size_t i = 0; i < record.segmentCount; i++)
+	{
+		m_segments.emplace_back(Vector2D {segments[i].x, segments[i].y});
+	}
+
+	m_mass = record.mass;
+	m_heading = record.heading;
+	m_movedSinceLastSpawn = record.movedSinceLastSpawn;
+	m_foodToDrop = record.foodToDrop;
+	m_boostedLastMove = (record.boostedLastMove != 0);
+
+	// recalculates the cached values
+	ensureSizeMatchesMass();
+}
@@ -22,6 +22,7 @@
 #include <memory>
 
 #include "types.h"
+#include "Checkpoint.h"
 #include "PositionObject.h"
 
 // forward declaration
@@ -153,6 +154,19 @@ class Snake
 
 		bool boostedLastMove(void) const { return m_boostedLastMove; }
 
+		/*!
+		 * Store the state of the snake in the bot record and append its
+		 * segments.
+		 */
+		void saveState(Checkpoint::BotRecord &record, std::vector<Checkpoint::SegmentRecord> &segments) const;
+
+		/*!
+		 * Replace the state of the snake by the one saved with saveState().
+		 *
+		 * \param segments   The saved segments of this snake.
+		 */
+		void restoreState(const Checkpoint::BotRecord &record, const Checkpoint::SegmentRecord *segments);
+
 		/*!
 		 * Get a list of head positions that were used during the last call to move().
 		 */
@@ -0,0 +1,659 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ClientConnection.h"
+#include "SpectatorArchive.h"
+
+using SpectatorArchive::IndexEntry;
+
+static std::runtime_error systemError(const std::string &what, const std::string &filename)
+{
+	return std::runtime_error(what + " " + filename + ": " + std::strerror(errno));
+}
+
+static bool writeAll(int fd, const void *data, std::size_t size)
+{
+	const char *pos = static_cast<const char*>(data);
+	while (size > 0)
+	{
+		ssize_t written = write(fd, pos, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		pos += written;
+		size -= static_cast<std::size_t>(written);
+	}
+	return true;
+}
+
+std::string SpectatorArchive::chunkPath(const std::string &directory, uint32_t chunk)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "chunk-%08u", chunk);
+	return directory + "/" + name;
+}
+
+ArchiveWriter::ArchiveWriter(const std::string &directory, uint32_t firstFrame)
+	: m_directory(directory)
+{
+	if ((mkdir(directory.c_str(), 0755) != 0) && (errno != EEXIST))
+	{
+		throw systemError("cannot create", directory);
+	}
+
+	std::string indexPath = directory + "/" + SpectatorArchive::INDEX_FILE;
+	m_indexFd = open(indexPath.c_str(), O_RDWR | O_CREAT, 0644);
+	if (m_indexFd < 0)
+	{
+		throw systemError("cannot open", indexPath);
+	}
+
+	struct stat st;
+	if (fstat(m_indexFd, &st) != 0)
+	{
+		std::runtime_error error = systemError("cannot stat", indexPath);
+		close(m_indexFd);
+		throw error;
+	}
+
+	// drop an entry that was not completely written
+	off_t entrySize = sizeof(IndexEntry);
+	m_indexSize = static_cast<uint64_t>(st.st_size - (st.st_size % entrySize));
+
+	IndexEntry last;
+	if ((m_indexSize > 0)
+			&& (pread(m_indexFd, &last, sizeof(last), m_indexSize - sizeof(last)) == sizeof(last)))
+	{
+		if (last.frame >= firstFrame)
+		{
+			std::cerr << "clearing the spectator archive, it continues after frame " << firstFrame << std::endl;
+			clear(last.chunk + 1);
+		}
+		else
+		{
+			m_nextChunk = last.chunk + 1;
+		}
+	}
+
+	if ((ftruncate(m_indexFd, m_indexSize) != 0) || (lseek(m_indexFd, 0, SEEK_END) < 0))
+	{
+		std::runtime_error error = systemError("cannot truncate", indexPath);
+		close(m_indexFd);
+		throw error;
+	}
+
+	m_thread = std::thread([this]() { run(); });
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	m_framesAvailable.notify_one();
+	m_thread.join();
+
+	closeChunk();
+	close(m_indexFd);
+}
+
+void ArchiveWriter::clear(uint32_t chunks)
+{
+	for (uint32_t chunk = 0; chunk < chunks; chunk++)
+	{
+		unlink(SpectatorArchive::chunkPath(m_directory, chunk).c_str());
+	}
+
+	m_indexSize = 0;
+	m_nextChunk = 0;
+}
+
+void ArchiveWriter::addFrame(uint32_t frame, SharedBuffer update, SharedBuffer keyframe)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_queue.size() >= MAX_QUEUED_FRAMES)
+		{
+			if (m_droppedFrames++ == 0)
+			{
+				std::cerr << "spectator archive does not keep up, dropping frames" << std::endl;
+			}
+			m_gap = true;
+			return;
+		}
+		m_queue.push_back({frame, std::move(update), std::move(keyframe), m_gap});
+		m_gap = false;
+	}
+	m_framesAvailable.notify_one();
+}
+
+void ArchiveWriter::run(void)
+{
+	std::vector<QueuedFrame> frames;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_framesAvailable.wait(lock, [this]() { return m_shutdown || !m_queue.empty(); });
+		if (m_queue.empty())
+		{
+			return; // shutdown
+		}
+
+		frames.swap(m_queue);
+		m_droppedFrames = 0;
+		lock.unlock();
+
+		for (auto &frame: frames)
+		{
+			writeFrame(frame);
+		}
+
+		frames.clear();
+		lock.lock();
+	}
+}
+
+void ArchiveWriter::writeFrame(const QueuedFrame &frame)
+{
+	if (frame.afterGap)
+	{
+		closeChunk();
+	}
+
+	if ((m_chunkFd >= 0) && !frame.update->empty())
+	{
+		if (!writeAll(m_chunkFd, frame.update->data(), frame.update->size()))
+		{
+			std::cerr << "cannot write to the spectator archive: " << std::strerror(errno) << std::endl;
+			closeChunk();
+		}
+		else
+		{
+			appendEntry(frame.frame, 0, m_chunkSize, frame.update->size());
+			m_chunkSize += frame.update->size();
+		}
+	}
+
+	if (frame.keyframe)
+	{
+		closeChunk();
+		startChunk(frame.frame, frame.keyframe);
+	}
+}
+
+void ArchiveWriter::startChunk(uint32_t frame, const SharedBuffer &keyframe)
+{
+	std::string path = SpectatorArchive::chunkPath(m_directory, m_nextChunk);
+
+	m_chunkFd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (m_chunkFd < 0)
+	{
+		std::cerr << "cannot create " << path << ": " << std::strerror(errno) << std::endl;
+		return;
+	}
+
+	m_chunk = m_nextChunk++;
+	m_chunkSize = 0;
+
+	if (!writeAll(m_chunkFd, keyframe->data(), keyframe->size()))
+	{
+		std::cerr << "cannot write " << path << ": " << std::strerror(errno) << std::endl;
+		closeChunk();
+		return;
+	}
+
+	appendEntry(frame, SpectatorArchive::INDEX_KEYFRAME, 0, keyframe->size());
+	m_chunkSize = keyframe->size();
+}
+
+void ArchiveWriter::closeChunk(void)
+{
+	if (m_chunkFd >= 0)
+	{
+		close(m_chunkFd);
+		m_chunkFd = -1;
+	}
+}
+
+void ArchiveWriter::appendEntry(uint32_t frame, uint32_t flags, uint64_t offset, uint64_t size)
+{
+	if (m_chunkFd < 0)
+	{
+		return;
+	}
+
+	IndexEntry entry;
+	entry.frame = frame;
+	entry.flags = flags;
+	entry.chunk = m_chunk;
+	entry.reserved = 0;
+	entry.offset = offset;
+	entry.size = size;
+
+	// the chunk data is written before its entry, so readers of the index
+	// always find it
+	if (!writeAll(m_indexFd, &entry, sizeof(entry)))
+	{
+		std::cerr << "cannot write the spectator archive index: " << std::strerror(errno) << std::endl;
+
+		// remove a partial entry; the chunk cannot be continued without
+		// its entries
+		if (ftruncate(m_indexFd, m_indexSize) == 0)
+		{
+			lseek(m_indexFd, 0, SEEK_END);
+		}
+		closeChunk();
+		return;
+	}
+
+	m_indexSize += sizeof(entry);
+}
+
+ArchiveReader::ArchiveReader(const std::string &directory)
+	: m_directory(directory)
+{
+}
+
+ArchiveReader::~ArchiveReader()
+{
+	if (m_indexFd >= 0)
+	{
+		close(m_indexFd);
+	}
+}
+
+void ArchiveReader::refresh(void)
+{
+	if (m_indexFd < 0)
+	{
+		std::string indexPath = m_directory + "/" + SpectatorArchive::INDEX_FILE;
+		m_indexFd = open(indexPath.c_str(), O_RDONLY);
+		if (m_indexFd < 0)
+		{
+			return;
+		}
+	}
+
+	IndexEntry entries[256];
+	while (true)
+	{
+		ssize_t bytes = pread(m_indexFd, entries, sizeof(entries), m_entries.size() * sizeof(IndexEntry));
+		if (bytes <= 0)
+		{
+			break;
+		}
+
+		// an incomplete entry is read again with the next refresh
+		std::size_t count = static_cast<std::size_t>(bytes) / sizeof(IndexEntry);
+		m_entries.insert(m_entries.end(), entries, entries + count);
+
+		if (static_cast<std::size_t>(bytes) < sizeof(entries))
+		{
+			break;
+		}
+	}
+}
+
+bool ArchiveReader::findFrame(uint32_t frame, std::size_t &keyframeEntry, std::size_t &lastEntry) const
+{
+	auto it = std::upper_bound(m_entries.begin(), m_entries.end(), frame,
+		[](uint32_t f, const IndexEntry &entry) { return f < entry.frame; });
+
+	if (it == m_entries.begin())
+	{
+		return false;
+	}
+
+	lastEntry = static_cast<std::size_t>(it - m_entries.begin()) - 1;
+	for (std::size_t i = lastEntry + 1; i-- > 0;)
+	{
+		if (m_entries[i].flags & SpectatorArchive::INDEX_KEYFRAME)
+		{
+			keyframeEntry = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int ArchiveReader::openChunk(uint32_t chunk) const
+{
+	return open(SpectatorArchive::chunkPath(m_directory, chunk).c_str(), O_RDONLY);
+}
+
+/*!
+ * Read a range of a file into the page cache and wait until it is there.
+ */
+static void loadIntoCache(int fd, off_t offset, off_t end)
+{
+	static const off_t pageSize = sysconf(_SC_PAGESIZE);
+
+	off_t start = offset - (offset % pageSize);
+	std::size_t length = static_cast<std::size_t>(end - start);
+	if (length == 0)
+	{
+		return;
+	}
+
+	// populating the mapping reads all pages; they stay cached when it is
+	// removed again
+	void *data = mmap(nullptr, length, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, start);
+	if (data != MAP_FAILED)
+	{
+		munmap(data, length);
+	}
+}
+
+void ArchiveLoader::ChunkFile::close(void)
+{
+	if (fd >= 0)
+	{
+		::close(fd);
+		fd = -1;
+	}
+}
+
+ArchiveLoader::ArchiveLoader(const std::string &directory)
+	: m_archive(directory)
+{
+	m_thread = std::thread([this]() { run(); });
+}
+
+ArchiveLoader::~ArchiveLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+	}
+	m_workAvailable.notify_one();
+	m_thread.join();
+}
+
+std::shared_ptr<ArchiveLoader::Replay> ArchiveLoader::open(uint32_t frame)
+{
+	auto replay = std::make_shared<Replay>();
+	replay->startFrame = frame;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_replays.push_back(replay);
+	}
+	m_workAvailable.notify_one();
+
+	return replay;
+}
+
+void ArchiveLoader::seek(Replay &replay, uint32_t frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		replay.generation++;
+		replay.startFrame = frame;
+		replay.ready.clear();
+		replay.finished = false;
+	}
+	m_workAvailable.notify_one();
+}
+
+void ArchiveLoader::close(Replay &replay)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		replay.closed = true;
+		replay.ready.clear();
+	}
+	m_workAvailable.notify_one();
+}
+
+ArchiveLoader::TakeResult ArchiveLoader::take(Replay &replay, Range &range)
+{
+	TakeResult result;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!replay.ready.empty())
+		{
+			range = std::move(replay.ready.front());
+			replay.ready.pop_front();
+			result = RANGE_TAKEN;
+		}
+		else
+		{
+			return replay.finished ? REPLAY_FINISHED : RANGE_PENDING;
+		}
+	}
+
+	// there is room for another range
+	m_workAvailable.notify_one();
+	return result;
+}
+
+bool ArchiveLoader::needsWork(const Replay &replay) const
+{
+	return replay.closed || (replay.generation != replay.loadedGeneration)
+		|| (!replay.finished && (replay.ready.size() < PREFETCH_FRAMES));
+}
+
+void ArchiveLoader::run(void)
+{
+	std::vector< std::shared_ptr<Replay> > replays;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_workAvailable.wait(lock, [this]() {
+				return m_shutdown || std::any_of(m_replays.begin(), m_replays.end(),
+					[this](const std::shared_ptr<Replay> &replay) { return needsWork(*replay); });
+			});
+
+		if (m_shutdown)
+		{
+			return;
+		}
+
+		m_replays.erase(
+			std::remove_if(m_replays.begin(), m_replays.end(),
+				[](const std::shared_ptr<Replay> &replay) { return replay->closed; }),
+			m_replays.end());
+
+		replays = m_replays;
+
+		for (auto &replay: replays)
+		{
+			while (!replay->closed && needsWork(*replay) && !m_shutdown)
+			{
+				uint64_t generation = replay->generation;
+				uint32_t startFrame = replay->startFrame;
+				bool restart = (generation != replay->loadedGeneration);
+				lock.unlock();
+
+				Range range;
+				LoadResult result = loadNext(*replay, startFrame, restart, range);
+				if ((result == LOADED) || (result == SKIPPED))
+				{
+					replay->loadedGeneration = generation;
+				}
+
+				lock.lock();
+
+				// a seek in the meantime makes the result useless
+				if (generation != replay->generation)
+				{
+					continue;
+				}
+
+				if (result == LOADED)
+				{
+					replay->ready.push_back(std::move(range));
+				}
+				else if ((result == FAILED) || (result == AT_END))
+				{
+					// the player returns to the live game after sending the
+					// ranges that are ready
+					replay->loadedGeneration = generation;
+					replay->finished = true;
+				}
+			}
+		}
+
+		replays.clear();
+	}
+}
+
+ArchiveLoader::LoadResult ArchiveLoader::loadNext(Replay &replay, uint32_t startFrame, bool restart, Range &range)
+{
+	if (restart)
+	{
+		m_archive.refresh();
+
+		std::size_t keyframeEntry, lastEntry;
+		if (!m_archive.findFrame(startFrame, keyframeEntry, lastEntry))
+		{
+			std::cerr << "frame " << startFrame << " requested for a replay is not archived" << std::endl;
+			return FAILED;
+		}
+
+		// the keyframe and the updates after it are stored one after another
+		const IndexEntry &keyframe = m_archive[keyframeEntry];
+		const IndexEntry &last = m_archive[lastEntry];
+		if (!openChunk(replay, keyframe.chunk))
+		{
+			return FAILED;
+		}
+
+		range.offset = static_cast<off_t>(keyframe.offset);
+		range.end = static_cast<off_t>(last.offset + last.size);
+		replay.lastFrame = last.frame;
+		replay.nextEntry = lastEntry + 1;
+	}
+	else
+	{
+		if (replay.nextEntry >= m_archive.size())
+		{
+			m_archive.refresh();
+			if (replay.nextEntry >= m_archive.size())
+			{
+				return AT_END;
+			}
+		}
+
+		const IndexEntry &entry = m_archive[replay.nextEntry++];
+
+		// a chunk's keyframe is only needed if the update of its frame is
+		// missing in the previous chunk
+		if ((entry.flags & SpectatorArchive::INDEX_KEYFRAME) && (entry.frame == replay.lastFrame))
+		{
+			return SKIPPED;
+		}
+
+		if (!openChunk(replay, entry.chunk))
+		{
+			return FAILED;
+		}
+
+		range.offset = static_cast<off_t>(entry.offset);
+		range.end = static_cast<off_t>(entry.offset + entry.size);
+		replay.lastFrame = entry.frame;
+	}
+
+	range.file = replay.chunk;
+	loadIntoCache(range.file->fd, range.offset, range.end);
+	return LOADED;
+}
+
+bool ArchiveLoader::openChunk(Replay &replay, uint32_t chunk)
+{
+	if (replay.chunk && (replay.loadedChunk == chunk))
+	{
+		return true;
+	}
+
+	int fd = m_archive.openChunk(chunk);
+	if (fd < 0)
+	{
+		std::cerr << "cannot open chunk " << chunk << " of the spectator archive: " << std::strerror(errno) << std::endl;
+		replay.chunk = nullptr;
+		return false;
+	}
+
+	// ranges that were handed out keep the previous chunk open
+	replay.chunk = std::make_shared<ChunkFile>(fd);
+	replay.loadedChunk = chunk;
+	return true;
+}
+
+ArchivePlayer::ArchivePlayer(ArchiveLoader &loader, uint32_t frame)
+	: m_loader(loader)
+	, m_replay(loader.open(frame))
+{
+}
+
+ArchivePlayer::~ArchivePlayer()
+{
+	m_loader.close(*m_replay);
+}
+
+void ArchivePlayer::seek(uint32_t frame)
+{
+	m_loader.seek(*m_replay, frame);
+}
+
+bool ArchivePlayer::sendNext(ClientConnection &client)
+{
+	// the stream may only change between complete messages
+	while (m_range.offset >= m_range.end)
+	{
+		if (m_stopping)
+		{
+			return false;
+		}
+
+		switch (m_loader.take(*m_replay, m_range))
+		{
+			case ArchiveLoader::RANGE_TAKEN:
+				break;
+
+			case ArchiveLoader::RANGE_PENDING:
+				return true;
+
+			case ArchiveLoader::REPLAY_FINISHED:
+				return false;
+		}
+	}
+
+	return client.sendFile(m_range.file->fd, m_range.offset, m_range.end);
+}
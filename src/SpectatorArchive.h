@@ -0,0 +1,337 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "SharedBuffer.h"
+
+class ClientConnection;
+
+/*!
+ * \brief Archive of the update stream, from which viewers can watch past
+ *        frames.
+ *
+ * The archive is a directory of chunk files and an index. A chunk starts
+ * with a keyframe (the world state after a frame) and continues with the
+ * updates of the following frames, up to the next keyframe. Chunks contain
+ * the messages exactly as they are sent to a client with default settings,
+ * so they are sent from the file with sendfile() and never pass through the
+ * server's memory.
+ *
+ * The index has one fixed-size IndexEntry per update and per keyframe, in
+ * the order they were written. Frame numbers increase through the whole
+ * archive; it is cleared if the server starts at an older frame.
+ */
+namespace SpectatorArchive
+{
+	static constexpr const char* INDEX_FILE = "index";
+
+	enum IndexFlags : uint32_t {
+		INDEX_KEYFRAME = 1, //!< the world state at the start of a chunk
+	};
+
+	struct IndexEntry
+	{
+		uint32_t frame;
+		uint32_t flags;
+		uint32_t chunk;
+		uint32_t reserved;
+		uint64_t offset; //!< in the chunk file
+		uint64_t size;
+	};
+
+	std::string chunkPath(const std::string &directory, uint32_t chunk);
+}
+
+/*!
+ * \brief Appends the update stream to the archive on a background thread.
+ *
+ * If the disk does not keep up, frames are dropped and the current chunk is
+ * closed; the archive continues with the next keyframe.
+ */
+class ArchiveWriter
+{
+	public:
+		/*!
+		 * \param firstFrame   The first frame that will be added; an archive
+		 *                     with newer frames is cleared.
+		 * \throws std::runtime_error if the archive cannot be opened.
+		 */
+		ArchiveWriter(const std::string &directory, uint32_t firstFrame);
+
+		/*!
+		 * Writes all queued frames and stops the thread.
+		 */
+		~ArchiveWriter();
+
+		ArchiveWriter(const ArchiveWriter&) = delete;
+		ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+		/*!
+		 * \param keyframe   World state after the frame, or nullptr.
+		 */
+		void addFrame(uint32_t frame, SharedBuffer update, SharedBuffer keyframe);
+
+	private:
+		static constexpr const std::size_t MAX_QUEUED_FRAMES = 600;
+
+		struct QueuedFrame
+		{
+			uint32_t frame;
+			SharedBuffer update;
+			SharedBuffer keyframe;
+			bool afterGap; //!< frames before this one were dropped
+		};
+
+		std::string m_directory;
+		int m_indexFd = -1;
+		uint64_t m_indexSize = 0;
+		int m_chunkFd = -1; //!< -1 while waiting for a keyframe
+		uint32_t m_chunk = 0;
+		uint32_t m_nextChunk = 0;
+		uint64_t m_chunkSize = 0;
+
+		std::mutex m_mutex;
+		std::condition_variable m_framesAvailable;
+		std::vector<QueuedFrame> m_queue;
+		std::size_t m_droppedFrames = 0;
+		bool m_gap = false;
+		bool m_shutdown = false;
+
+		std::thread m_thread;
+
+		void clear(uint32_t chunks);
+		void run(void);
+		void writeFrame(const QueuedFrame &frame);
+		void startChunk(uint32_t frame, const SharedBuffer &keyframe);
+		void closeChunk(void);
+		void appendEntry(uint32_t frame, uint32_t flags, uint64_t offset, uint64_t size);
+};
+
+/*!
+ * \brief Read access to the archive index, for the ArchiveLoader.
+ *
+ * The index is read incrementally while the ArchiveWriter appends to it.
+ */
+class ArchiveReader
+{
+	public:
+		ArchiveReader(const std::string &directory);
+		~ArchiveReader();
+
+		ArchiveReader(const ArchiveReader&) = delete;
+		ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+		/*!
+		 * Read the entries that were appended since the last call.
+		 */
+		void refresh(void);
+
+		std::size_t size(void) const { return m_entries.size(); }
+		const SpectatorArchive::IndexEntry& operator[](std::size_t i) const { return m_entries[i]; }
+
+		/*!
+		 * Find the entries a viewer needs to see the given frame: the
+		 * keyframe before it and all updates up to the frame.
+		 *
+		 * \returns   false if the frame is not in the archive.
+		 */
+		bool findFrame(uint32_t frame, std::size_t &keyframeEntry, std::size_t &lastEntry) const;
+
+		/*!
+		 * \returns   A file descriptor of the chunk, or -1.
+		 */
+		int openChunk(uint32_t chunk) const;
+
+	private:
+		std::string m_directory;
+		int m_indexFd = -1;
+		std::vector<SpectatorArchive::IndexEntry> m_entries;
+};
+
+/*!
+ * \brief Prepares the data of all replays on a background thread.
+ *
+ * Reading the index, opening chunks and reading chunk data from the disk may
+ * block, so the network thread never does it. For each replay, the loader
+ * looks up the ranges of the chunks to send next, up to PREFETCH_FRAMES
+ * ahead, and reads them into the page cache before handing them over. The
+ * network thread then only calls sendfile() on cached data.
+ */
+class ArchiveLoader
+{
+	public:
+		struct ChunkFile
+		{
+			int fd;
+
+			ChunkFile(int fd) : fd(fd) {}
+			~ChunkFile() { close(); }
+			void close(void);
+
+			ChunkFile(const ChunkFile&) = delete;
+			ChunkFile& operator=(const ChunkFile&) = delete;
+		};
+
+		/*!
+		 * A range of a chunk file whose data is in the page cache.
+		 */
+		struct Range
+		{
+			std::shared_ptr<ChunkFile> file;
+			off_t offset;
+			off_t end;
+		};
+
+		/*!
+		 * State of one replay, shared by its player and the loader.
+		 */
+		struct Replay
+		{
+			// guarded by the loader's mutex
+			std::deque<Range> ready;
+			uint64_t generation = 0; //!< incremented by every seek
+			uint32_t startFrame = 0; //!< the frame to start at in this generation
+			bool finished = false;   //!< no more ranges: reached the end of the archive, or failed
+			bool closed = false;
+
+			// used by the loader thread only
+			uint64_t loadedGeneration = UINT64_MAX;
+			std::size_t nextEntry = 0;
+			uint32_t lastFrame = 0; //!< frame of the last update loaded
+			std::shared_ptr<ChunkFile> chunk;
+			uint32_t loadedChunk = 0;
+		};
+
+		enum TakeResult
+		{
+			RANGE_TAKEN,
+			RANGE_PENDING,  //!< the loader did not catch up yet
+			REPLAY_FINISHED
+		};
+
+		ArchiveLoader(const std::string &directory);
+		~ArchiveLoader();
+
+		ArchiveLoader(const ArchiveLoader&) = delete;
+		ArchiveLoader& operator=(const ArchiveLoader&) = delete;
+
+		/*!
+		 * Start loading a replay at the given frame.
+		 */
+		std::shared_ptr<Replay> open(uint32_t frame);
+
+		/*!
+		 * Drop the prepared ranges and continue at another frame.
+		 */
+		void seek(Replay &replay, uint32_t frame);
+
+		/*!
+		 * Stop loading for a replay.
+		 */
+		void close(Replay &replay);
+
+		/*!
+		 * Take the next prepared range of a replay.
+		 */
+		TakeResult take(Replay &replay, Range &range);
+
+	private:
+		// one second of the live game
+		static constexpr const std::size_t PREFETCH_FRAMES = 60;
+
+		enum LoadResult
+		{
+			LOADED,
+			SKIPPED, //!< the entry is not needed
+			AT_END,
+			FAILED
+		};
+
+		ArchiveReader m_archive; // used by the loader thread only
+
+		std::mutex m_mutex;
+		std::condition_variable m_workAvailable;
+		std::vector< std::shared_ptr<Replay> > m_replays;
+		bool m_shutdown = false;
+
+		std::thread m_thread;
+
+		bool needsWork(const Replay &replay) const;
+		void run(void);
+		LoadResult loadNext(Replay &replay, uint32_t startFrame, bool restart, Range &range);
+		bool openChunk(Replay &replay, uint32_t chunk);
+};
+
+/*!
+ * \brief Plays the archive to one viewer, in the pace of the live game.
+ *
+ * The data is prepared by the ArchiveLoader, so a replay only starts after
+ * its first range was loaded.
+ */
+class ArchivePlayer
+{
+	public:
+		/*!
+		 * Start the replay at the given frame; the first range sent contains
+		 * everything the viewer needs to show it. If the frame is not in the
+		 * archive, the replay ends without sending anything.
+		 */
+		ArchivePlayer(ArchiveLoader &loader, uint32_t frame);
+		~ArchivePlayer();
+
+		ArchivePlayer(const ArchivePlayer&) = delete;
+		ArchivePlayer& operator=(const ArchivePlayer&) = delete;
+
+		/*!
+		 * Continue at another frame, as soon as the frame being sent is
+		 * complete.
+		 */
+		void seek(uint32_t frame);
+
+		/*!
+		 * End the replay as soon as the frame being sent is complete.
+		 */
+		void stop(void) { m_stopping = true; }
+
+		/*!
+		 * Send the next frame, or continue the current one if the client did
+		 * not take all of it yet. Called once per frame of the live game.
+		 *
+		 * \returns   false if the replay reached the live game, was stopped
+		 *            or the archive cannot be read.
+		 */
+		bool sendNext(ClientConnection &client);
+
+	private:
+		ArchiveLoader &m_loader;
+		std::shared_ptr<ArchiveLoader::Replay> m_replay;
+		ArchiveLoader::Range m_range{nullptr, 0, 0}; //!< pending part of the current range
+		bool m_stopping = false;
+};
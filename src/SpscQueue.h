@@ -0,0 +1,78 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/*!
+ * \brief Bounded lock-free queue for exactly one producer and one consumer
+ *        thread.
+ *
+ * push() may only be called by the producer, pop() only by the consumer.
+ * Each side writes only its own index, so no locks or read-modify-write
+ * operations are needed.
+ */
+template <typename T, std::size_t CAPACITY>
+class SpscQueue
+{
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+	private:
+		std::array<T, CAPACITY> m_items;
+
+		// on separate cache lines, as they are written by different threads
+		alignas(64) std::atomic<std::size_t> m_head{0}; // next item to pop
+		alignas(64) std::atomic<std::size_t> m_tail{0}; // next free slot
+
+	public:
+		/*!
+		 * \returns   false if the queue is full; the item is not moved then.
+		 */
+		bool push(T &&item)
+		{
+			std::size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail - m_head.load(std::memory_order_acquire) >= CAPACITY)
+			{
+				return false;
+			}
+
+			m_items[tail & (CAPACITY - 1)] = std::move(item);
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		/*!
+		 * \returns   false if the queue is empty.
+		 */
+		bool pop(T &item)
+		{
+			std::size_t head = m_head.load(std::memory_order_relaxed);
+			if (head == m_tail.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+
+			// moving out releases the resources held by the slot
+			item = std::move(m_items[head & (CAPACITY - 1)]);
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+};
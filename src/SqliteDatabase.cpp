@@ -0,0 +1,471 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <sqlite3.h>
+
+#include "SqliteDatabase.h"
+
+using namespace db;
+
+static const char* BOT_DATA_QUERY =
+	"SELECT u.id, u.username, sv.id, sv.code, IFNULL(p.viewer_key, 0) AS viewer_key "
+	"FROM core_userprofile p "
+	"LEFT JOIN auth_user u ON (u.id=p.user_id) "
+	"LEFT JOIN core_snakeversion sv ON (sv.id=p.active_snake_id) "
+	"WHERE p.active_snake_id IS NOT NULL AND ";
+
+/*!
+ * Aggregate hash_xor(id): XOR of a 64 bit hash of each value, so the result
+ * does not depend on the order of the rows. SQLite has no CRC32() and
+ * BIT_XOR() like MySQL.
+ */
+static void hashXorStep(sqlite3_context *ctx, int, sqlite3_value **argv)
+{
+	uint64_t *acc = static_cast<uint64_t*>(sqlite3_aggregate_context(ctx, sizeof(uint64_t)));
+	if (!acc)
+	{
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+
+	// splitmix64 finalizer
+	uint64_t x = static_cast<uint64_t>(sqlite3_value_int64(argv[0]));
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	*acc ^= x ^ (x >> 31);
+}
+
+static void hashXorFinal(sqlite3_context *ctx)
+{
+	uint64_t *acc = static_cast<uint64_t*>(sqlite3_aggregate_context(ctx, 0));
+	sqlite3_result_int64(ctx, acc ? static_cast<int64_t>(*acc) : 0);
+}
+
+SqliteDatabase::Statement::Statement(sqlite3 *db, const std::string &sql)
+	: _db(db)
+{
+	if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &_stmt, nullptr) != SQLITE_OK)
+	{
+		throw std::runtime_error(sqlite3_errmsg(_db));
+	}
+}
+
+SqliteDatabase::Statement::~Statement()
+{
+	sqlite3_finalize(_stmt);
+}
+
+SqliteDatabase::Statement& SqliteDatabase::Statement::bind(int idx, int64_t value)
+{
+	sqlite3_bind_int64(_stmt, idx, value);
+	return *this;
+}
+
+SqliteDatabase::Statement& SqliteDatabase::Statement::bind(int idx, double value)
+{
+	sqlite3_bind_double(_stmt, idx, value);
+	return *this;
+}
+
+SqliteDatabase::Statement& SqliteDatabase::Statement::bind(int idx, const std::string &value)
+{
+	sqlite3_bind_text(_stmt, idx, value.data(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+	return *this;
+}
+
+SqliteDatabase::Statement& SqliteDatabase::Statement::bindNull(int idx)
+{
+	sqlite3_bind_null(_stmt, idx);
+	return *this;
+}
+
+bool SqliteDatabase::Statement::step(void)
+{
+	int rc = sqlite3_step(_stmt);
+	if (rc == SQLITE_ROW)
+	{
+		return true;
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		std::string message = sqlite3_errmsg(_db);
+		reset();
+		throw std::runtime_error(message);
+	}
+	return false;
+}
+
+void SqliteDatabase::Statement::execute(void)
+{
+	step();
+	reset();
+}
+
+void SqliteDatabase::Statement::reset(void)
+{
+	sqlite3_reset(_stmt);
+	sqlite3_clear_bindings(_stmt);
+}
+
+int64_t SqliteDatabase::Statement::getInt64(int col)
+{
+	return sqlite3_column_int64(_stmt, col);
+}
+
+std::string SqliteDatabase::Statement::getString(int col)
+{
+	const unsigned char *text = sqlite3_column_text(_stmt, col);
+	int size = sqlite3_column_bytes(_stmt, col);
+	return text ? std::string(reinterpret_cast<const char*>(text), size) : std::string();
+}
+
+std::unique_ptr<BotScript> SqliteDatabase::Statement::getBotScript(void)
+{
+	return std::make_unique<BotScript>(
+		static_cast<int>(getInt64(0)),
+		getString(1),
+		static_cast<int>(getInt64(2)),
+		static_cast<uint64_t>(getInt64(4)),
+		getString(3)
+	);
+}
+
+SqliteDatabase::~SqliteDatabase()
+{
+	// statements have to be finalized before the connection is closed
+	_getBotDataStmt = nullptr;
+	_getActiveBotIdsStmt = nullptr;
+	_getActiveBotsChecksumStmt = nullptr;
+	_getActiveCommandsStmt = nullptr;
+	_commandCompletedStmt = nullptr;
+	_reportBotKilledStmt = nullptr;
+	_disableBotVersionStmt = nullptr;
+	_saveBotVersionErrorMessageStmt = nullptr;
+
+	sqlite3_close(_db);
+}
+
+void SqliteDatabase::exec(const std::string &sql)
+{
+	char *error = nullptr;
+	if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK)
+	{
+		std::string message = error ? error : "unknown error";
+		sqlite3_free(error);
+		throw std::runtime_error(message);
+	}
+}
+
+void SqliteDatabase::Connect(std::string filename)
+{
+	if (sqlite3_open(filename.c_str(), &_db) != SQLITE_OK)
+	{
+		throw std::runtime_error("cannot open " + filename + ": " + sqlite3_errmsg(_db));
+	}
+
+	// the game, the writer and the poller use separate connections
+	sqlite3_busy_timeout(_db, 5000);
+	exec("PRAGMA journal_mode=WAL");
+
+	if (sqlite3_create_function(_db, "hash_xor", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+			nullptr, hashXorStep, hashXorFinal) != SQLITE_OK)
+	{
+		throw std::runtime_error(sqlite3_errmsg(_db));
+	}
+
+	exec(
+		"CREATE TABLE IF NOT EXISTS auth_user ("
+		" id INTEGER PRIMARY KEY, username TEXT NOT NULL UNIQUE);"
+		"CREATE TABLE IF NOT EXISTS core_snakeversion ("
+		" id INTEGER PRIMARY KEY, user_id INTEGER NOT NULL, code TEXT NOT NULL,"
+		" server_error_message TEXT);"
+		"CREATE TABLE IF NOT EXISTS core_userprofile ("
+		" user_id INTEGER PRIMARY KEY, active_snake_id INTEGER, viewer_key INTEGER);"
+		"CREATE TABLE IF NOT EXISTS core_servercommand ("
+		" id INTEGER PRIMARY KEY, user_id INTEGER NOT NULL, command TEXT NOT NULL,"
+		" result INTEGER, result_msg TEXT, dt_created TEXT DEFAULT CURRENT_TIMESTAMP,"
+		" dt_processed TEXT);"
+		"CREATE TABLE IF NOT EXISTS core_snakegame ("
+		" id INTEGER PRIMARY KEY, user_id INTEGER NOT NULL, snake_version_id INTEGER NOT NULL,"
+		" start_frame INTEGER, end_frame INTEGER, killer_id INTEGER, final_mass REAL,"
+		" natural_food_consumed REAL, carrison_food_consumed REAL, hunted_food_consumed REAL,"
+		" end_date TEXT);"
+		// not part of the web application: users created by ImportBots()
+		"CREATE TABLE IF NOT EXISTS server_importedbot ("
+		" user_id INTEGER PRIMARY KEY);"
+	);
+
+	_getBotDataStmt = std::make_unique<Statement>(_db, std::string(BOT_DATA_QUERY) + "p.user_id=?");
+
+	_getActiveBotIdsStmt = std::make_unique<Statement>(_db,
+		"SELECT user_id FROM core_userprofile WHERE active_snake_id IS NOT NULL"
+	);
+
+	_getActiveBotsChecksumStmt = std::make_unique<Statement>(_db,
+		"SELECT COUNT(*), IFNULL(SUM(user_id), 0), hash_xor(user_id) "
+		"FROM core_userprofile WHERE active_snake_id IS NOT NULL"
+	);
+
+	_getActiveCommandsStmt = std::make_unique<Statement>(_db,
+		"SELECT id, user_id, command FROM core_servercommand WHERE result IS NULL ORDER BY dt_created"
+	);
+
+	_commandCompletedStmt = std::make_unique<Statement>(_db,
+		"UPDATE core_servercommand SET result=?, result_msg=?, dt_processed=datetime('now') WHERE id=?"
+	);
+
+	_reportBotKilledStmt = std::make_unique<Statement>(_db,
+		"INSERT INTO core_snakegame "
+		" (user_id, snake_version_id, start_frame, end_frame, killer_id, final_mass, natural_food_consumed, carrison_food_consumed, hunted_food_consumed, end_date) "
+		"VALUES "
+		" (?, ?, ?, ?, ?, ?, ?, ?, ?, datetime('now'))"
+	);
+
+	_disableBotVersionStmt = std::make_unique<Statement>(_db,
+		"UPDATE core_userprofile SET active_snake_id=NULL WHERE active_snake_id=?"
+	);
+
+	_saveBotVersionErrorMessageStmt = std::make_unique<Statement>(_db,
+		"UPDATE core_snakeversion SET server_error_message=? WHERE id=?"
+	);
+}
+
+void SqliteDatabase::ImportBots(std::string directory, int copies)
+{
+	DIR *dir = opendir(directory.c_str());
+	if (dir == nullptr)
+	{
+		throw std::runtime_error("cannot open bot directory " + directory);
+	}
+
+	std::vector<std::string> files;
+	while (struct dirent *entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if ((name.size() > 4) && (name.compare(name.size() - 4, 4, ".lua") == 0))
+		{
+			files.push_back(name);
+		}
+	}
+	closedir(dir);
+	std::sort(files.begin(), files.end());
+
+	exec("BEGIN");
+	try
+	{
+		// bots of earlier imports stay inactive unless they are imported again
+		exec("UPDATE core_userprofile SET active_snake_id=NULL "
+			"WHERE user_id IN (SELECT user_id FROM server_importedbot)");
+
+		for (auto &file: files)
+		{
+			std::ifstream stream(directory + "/" + file);
+			std::ostringstream code;
+			code << stream.rdbuf();
+
+			std::string name = file.substr(0, file.size() - 4);
+			for (int i=0; i<copies; i++)
+			{
+				importBot((copies > 1) ? (name + "_" + std::to_string(i)) : name, code.str());
+			}
+		}
+		exec("COMMIT");
+	}
+	catch (...)
+	{
+		exec("ROLLBACK");
+		throw;
+	}
+
+	std::cerr << "imported " << files.size() << " bot scripts from " << directory << std::endl;
+}
+
+int64_t SqliteDatabase::importBot(const std::string &name, const std::string &code)
+{
+	Statement(_db, "INSERT OR IGNORE INTO auth_user (username) VALUES (?)").bind(1, name).execute();
+
+	Statement getUser(_db, "SELECT id FROM auth_user WHERE username=?");
+	getUser.bind(1, name).step();
+	int64_t userId = getUser.getInt64(0);
+
+	Statement(_db, "INSERT OR IGNORE INTO server_importedbot (user_id) VALUES (?)").bind(1, userId).execute();
+
+	// unchanged code keeps its version, and with it the bot's statistics
+	Statement getVersion(_db, "SELECT id FROM core_snakeversion WHERE user_id=? AND code=? ORDER BY id DESC LIMIT 1");
+	int64_t versionId;
+	if (getVersion.bind(1, userId).bind(2, code).step())
+	{
+		versionId = getVersion.getInt64(0);
+	}
+	else
+	{
+		Statement(_db, "INSERT INTO core_snakeversion (user_id, code) VALUES (?, ?)")
+			.bind(1, userId).bind(2, code).execute();
+		versionId = sqlite3_last_insert_rowid(_db);
+	}
+
+	Statement(_db,
+		"INSERT INTO core_userprofile (user_id, active_snake_id, viewer_key) VALUES (?, ?, ?) "
+		"ON CONFLICT (user_id) DO UPDATE SET active_snake_id=excluded.active_snake_id")
+		.bind(1, userId).bind(2, versionId).bind(3, userId).execute();
+
+	return userId;
+}
+
+std::unique_ptr<BotScript> SqliteDatabase::GetBotData(int bot_id)
+{
+	Statement &stmt = *_getBotDataStmt;
+	stmt.bind(1, static_cast<int64_t>(bot_id));
+
+	if (!stmt.step())
+	{
+		stmt.reset();
+		return nullptr;
+	}
+
+	auto result = stmt.getBotScript();
+	stmt.reset();
+	return result;
+}
+
+std::vector< std::unique_ptr<BotScript> > SqliteDatabase::GetBotDataBatch(const std::vector<int> &bot_ids)
+{
+	std::vector< std::unique_ptr<BotScript> > retval;
+
+	for (std::size_t start=0; start<bot_ids.size(); start+=BOT_DATA_BATCH_SIZE)
+	{
+		std::size_t end = std::min(start + static_cast<std::size_t>(BOT_DATA_BATCH_SIZE), bot_ids.size());
+
+		std::string sql = std::string(BOT_DATA_QUERY) + "p.user_id IN (";
+		for (std::size_t i=start; i<end; i++)
+		{
+			sql += (i==start) ? "?" : ", ?";
+		}
+		sql += ")";
+
+		Statement stmt(_db, sql);
+		for (std::size_t i=start; i<end; i++)
+		{
+			stmt.bind(static_cast<int>(i - start + 1), static_cast<int64_t>(bot_ids[i]));
+		}
+
+		while (stmt.step())
+		{
+			retval.push_back(stmt.getBotScript());
+		}
+	}
+
+	return retval;
+}
+
+std::vector<int> SqliteDatabase::GetActiveBotIds()
+{
+	std::vector<int> retval;
+	while (_getActiveBotIdsStmt->step())
+	{
+		retval.push_back(static_cast<int>(_getActiveBotIdsStmt->getInt64(0)));
+	}
+	_getActiveBotIdsStmt->reset();
+	return retval;
+}
+
+uint64_t SqliteDatabase::GetActiveBotsChecksum()
+{
+	Statement &stmt = *_getActiveBotsChecksumStmt;
+	stmt.step();
+
+	uint64_t count = stmt.getInt64(0);
+	uint64_t sum = stmt.getInt64(1);
+	uint64_t hashes = stmt.getInt64(2);
+	stmt.reset();
+
+	return hashes ^ (sum * 0x9E3779B97F4A7C15ull) ^ count;
+}
+
+std::vector<Command> SqliteDatabase::GetActiveCommands()
+{
+	std::vector<Command> retval;
+	while (_getActiveCommandsStmt->step())
+	{
+		retval.emplace_back(_getActiveCommandsStmt->getInt64(0), _getActiveCommandsStmt->getInt64(1),
+				_getActiveCommandsStmt->getString(2));
+	}
+	_getActiveCommandsStmt->reset();
+	return retval;
+}
+
+void SqliteDatabase::SetCommandCompleted(long commandId, bool result, std::string resultMsg)
+{
+	_commandCompletedStmt->bind(1, static_cast<int64_t>(result)).bind(2, resultMsg)
+		.bind(3, static_cast<int64_t>(commandId)).execute();
+}
+
+void SqliteDatabase::ReportBotKilled(long victim_id, long version_id, long start_frame, long end_frame, long killer_id, double final_mass, double natural_food_consumed, double carrison_food_consumed, double hunted_food_consumed)
+{
+	ReportBotsKilled({{victim_id, version_id, start_frame, end_frame, killer_id, final_mass,
+			natural_food_consumed, carrison_food_consumed, hunted_food_consumed}});
+}
+
+void SqliteDatabase::ReportBotsKilled(const std::vector<KillReport> &reports)
+{
+	// one transaction instead of a multi-row insert; the statement is
+	// prepared once and SQLite has no network round trips
+	exec("BEGIN");
+	try
+	{
+		for (auto &report: reports)
+		{
+			Statement &stmt = *_reportBotKilledStmt;
+			stmt.bind(1, static_cast<int64_t>(report.victim_id));
+			stmt.bind(2, static_cast<int64_t>(report.version_id));
+			stmt.bind(3, static_cast<int64_t>(report.start_frame));
+			stmt.bind(4, static_cast<int64_t>(report.end_frame));
+			if (report.killer_id<0) { stmt.bindNull(5); } else { stmt.bind(5, static_cast<int64_t>(report.killer_id)); }
+			stmt.bind(6, report.final_mass);
+			stmt.bind(7, report.natural_food_consumed);
+			stmt.bind(8, report.carrison_food_consumed);
+			stmt.bind(9, report.hunted_food_consumed);
+			stmt.execute();
+		}
+		exec("COMMIT");
+	}
+	catch (...)
+	{
+		exec("ROLLBACK");
+		throw;
+	}
+}
+
+void SqliteDatabase::DisableBotVersion(long version_id, std::string errorMessage)
+{
+	_disableBotVersionStmt->bind(1, static_cast<int64_t>(version_id)).execute();
+
+	if (!errorMessage.empty())
+	{
+		_saveBotVersionErrorMessageStmt->bind(1, errorMessage)
+			.bind(2, static_cast<int64_t>(version_id)).execute();
+	}
+}
@@ -0,0 +1,123 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "Database.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace db
+{
+	/*!
+	 * \brief Database in a local SQLite file, for running the server
+	 *        without MySQL.
+	 *
+	 * Uses the tables and columns of the web application that the server
+	 * accesses, and creates them if they do not exist. Several connections
+	 * (e.g. of background threads) can use the same file.
+	 */
+	class SqliteDatabase : public IDatabase
+	{
+		public:
+			~SqliteDatabase();
+
+			/*!
+			 * \param filename   Database file; created if it does not exist.
+			 */
+			void Connect(std::string filename);
+
+			/*!
+			 * Register every *.lua file in the directory as active bot, named
+			 * after the file. Existing bots of that name get a new version if
+			 * their code changed. Bots of earlier imports which are not part
+			 * of this one (e.g. with fewer copies) are deactivated.
+			 *
+			 * \param copies   Number of bots per file, for load tests.
+			 */
+			void ImportBots(std::string directory, int copies);
+
+			std::unique_ptr<BotScript> GetBotData(int bot_id) override;
+			std::vector< std::unique_ptr<BotScript> > GetBotDataBatch(const std::vector<int> &bot_ids) override;
+			std::vector<int> GetActiveBotIds() override;
+			uint64_t GetActiveBotsChecksum() override;
+			std::vector<Command> GetActiveCommands() override;
+			void SetCommandCompleted(long commandId, bool result, std::string resultMsg) override;
+			void ReportBotKilled(long victim_id, long version_id, long start_frame, long end_frame, long killer_id, double final_mass, double natural_food_consumed, double carrison_food_consumed, double hunted_food_consumed) override;
+			void ReportBotsKilled(const std::vector<KillReport> &reports) override;
+			void DisableBotVersion(long version_id, std::string errorMessage) override;
+
+		private:
+			static constexpr const std::size_t BOT_DATA_BATCH_SIZE = 500;
+
+			/*!
+			 * Prepared statement, reset and with cleared bindings after use.
+			 */
+			class Statement
+			{
+				public:
+					Statement(sqlite3 *db, const std::string &sql);
+					~Statement();
+
+					Statement(const Statement&) = delete;
+					Statement& operator=(const Statement&) = delete;
+
+					Statement& bind(int idx, int64_t value);
+					Statement& bind(int idx, double value);
+					Statement& bind(int idx, const std::string &value);
+					Statement& bindNull(int idx);
+
+					/*!
+					 * \returns   true if a result row is available.
+					 */
+					bool step(void);
+					void execute(void);
+					void reset(void);
+
+					int64_t getInt64(int col);
+					std::string getString(int col);
+
+					/*!
+					 * \returns   The current row as bot script.
+					 */
+					std::unique_ptr<BotScript> getBotScript(void);
+
+				private:
+					sqlite3 *_db;
+					sqlite3_stmt *_stmt = nullptr;
+			};
+
+			sqlite3 *_db = nullptr;
+			std::unique_ptr<Statement> _getBotDataStmt;
+			std::unique_ptr<Statement> _getActiveBotIdsStmt;
+			std::unique_ptr<Statement> _getActiveBotsChecksumStmt;
+			std::unique_ptr<Statement> _getActiveCommandsStmt;
+			std::unique_ptr<Statement> _commandCompletedStmt;
+			std::unique_ptr<Statement> _reportBotKilledStmt;
+			std::unique_ptr<Statement> _disableBotVersionStmt;
+			std::unique_ptr<Statement> _saveBotVersionErrorMessageStmt;
+
+			void exec(const std::string &sql);
+			int64_t importBot(const std::string &name, const std::string &code);
+	};
+}
@@ -20,6 +20,8 @@
 
 #include <memory>
 
+#include "SharedBuffer.h"
+
 // forward declarations
 class Food;
 class Bot;
@@ -27,6 +29,10 @@ class Field;
 
 /*!
  * \brief Interface for a game state change tracker.
+ *
+ * The food, bot move, log and stats events may also be tracked on worker
+ * threads. They are buffered per thread until mergeEventBuffers(). All other
+ * methods are only called on the thread that created the tracker.
  */
 class UpdateTracker
 {
@@ -101,13 +107,24 @@ class UpdateTracker
 		virtual void botStats(const std::shared_ptr<Bot> &bot) = 0;
 
 		/*!
-		 * Serialize the events added since the last reset or serialization.
+		 * Add the events buffered by worker threads to the frame, in an order
+		 * that does not depend on which thread recorded them. Events of one
+		 * bot must be recorded on a single thread between two merges.
+		 *
+		 * Call this at the end of each parallel phase, while no worker thread
+		 * tracks events and before the data referenced by the events (e.g. a
+		 * moved snake) changes again. serialize() merges the remaining events.
+		 */
+		virtual void mergeEventBuffers(void) = 0;
+
+		/*!
+		 * Serialize the events added since the last reset.
 		 *
-		 * This also resets all internal state.
+		 * Call reset() afterwards to start the next frame.
 		 *
-		 * \returns   A std::string containing the events in serialized form.
+		 * \returns   A shared buffer containing the events in serialized form.
 		 */
-		virtual std::string serialize(void) = 0;
+		virtual SharedBuffer serialize(void) = 0;
 
 		/*!
 		 * Reset the internal list of events. This is normally called once per
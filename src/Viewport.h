@@ -0,0 +1,97 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file
+ *
+ * \brief Coarse tiling of the field used to filter the update stream.
+ */
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+
+#include "types.h"
+#include "config.h"
+
+namespace viewport {
+
+	static constexpr const size_t TILES_X = config::VIEWPORT_TILES_X;
+	static constexpr const size_t TILES_Y = config::VIEWPORT_TILES_Y;
+
+	/*!
+	 * A set of tiles, e.g. the tiles a client can see or the tiles an event
+	 * touches.
+	 */
+	typedef std::bitset<TILES_X*TILES_Y> TileSet;
+
+	template <size_t SIZE> inline size_t wrapTile(long unwrapped)
+	{
+		long result = unwrapped % static_cast<long>(SIZE);
+		if (result < 0) { result += SIZE; }
+		return static_cast<size_t>(result);
+	}
+
+	inline size_t tileX(real_t x)
+	{
+		return wrapTile<TILES_X>(static_cast<long>(std::floor(x * TILES_X / config::FIELD_SIZE_X)));
+	}
+
+	inline size_t tileY(real_t y)
+	{
+		return wrapTile<TILES_Y>(static_cast<long>(std::floor(y * TILES_Y / config::FIELD_SIZE_Y)));
+	}
+
+	/*!
+	 * \returns   The index of the tile containing pos (coordinates may be
+	 *            unwrapped).
+	 */
+	inline size_t tileIndex(const Vector2D &pos)
+	{
+		return tileY(pos.y())*TILES_X + tileX(pos.x());
+	}
+
+	/*!
+	 * \returns   All tiles touching the given rectangle, which may extend
+	 *            beyond the field borders (the tiles wrap around).
+	 */
+	inline TileSet tilesInRect(real_t left, real_t top, real_t width, real_t height)
+	{
+		TileSet result;
+
+		long x1 = static_cast<long>(std::floor(left * TILES_X / config::FIELD_SIZE_X));
+		long y1 = static_cast<long>(std::floor(top * TILES_Y / config::FIELD_SIZE_Y));
+		long x2 = static_cast<long>(std::floor((left + width) * TILES_X / config::FIELD_SIZE_X));
+		long y2 = static_cast<long>(std::floor((top + height) * TILES_Y / config::FIELD_SIZE_Y));
+
+		// a rectangle larger than the field covers each tile once
+		x2 = std::min(x2, x1 + static_cast<long>(TILES_X) - 1);
+		y2 = std::min(y2, y1 + static_cast<long>(TILES_Y) - 1);
+
+		for (long y = y1; y <= y2; y++)
+		{
+			for (long x = x1; x <= x2; x++)
+			{
+				result.set(wrapTile<TILES_Y>(y)*TILES_X + wrapTile<TILES_X>(x));
+			}
+		}
+
+		return result;
+	}
+}
@@ -41,6 +41,15 @@ namespace config {
 	static constexpr const size_t SPATIAL_MAP_TILES_Y = 128;
 	static constexpr const size_t SPATIAL_MAP_RESERVE_COUNT = 10;
 
+	// Tiles used to filter the update stream for clients with a viewport.
+	// Coarser than the spatial map, so few distinct tile sets exist.
+	static constexpr const size_t VIEWPORT_TILES_X = 16;
+	static constexpr const size_t VIEWPORT_TILES_Y = 8;
+
+	// Distance by which client viewports are enlarged, so objects at the
+	// border are not cut off
+	static constexpr const real_t VIEWPORT_MARGIN = 64;
+
 	// Items of static food on field
 	static const std::size_t FIELD_STATIC_FOOD       = 12000;
 
@@ -100,4 +109,13 @@ namespace config {
 
 	// maximum number of colors a bot can have
 	static constexpr const size_t MAX_COLORS = 100;
+
+	// Maximum amount of data queued for a client. If a client does not keep
+	// up, its pending updates are dropped and it is resynchronized with a
+	// full world state.
+	static constexpr const size_t CLIENT_MAX_QUEUED_BYTES = 8*1024*1024;
+
+	// zstd level for clients requesting a compressed stream. Each frame is
+	// compressed once for all of them, but within the frame time.
+	static constexpr const int STREAM_COMPRESSION_LEVEL = 3;
 }
@@ -22,20 +22,25 @@
 #include "Food.h"
 #include "Field.h"
 #include "config.h"
+#include "FastMath.h"
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 
 LuaBot::LuaBot(Bot &bot, std::string script)
 	: m_bot(bot)
 	, m_allocator(config::LUA_MEM_POOL_SIZE_BYTES, config::LUA_MEM_POOL_BLOCK_SIZE_BYTES)
 	, m_lua_state(sol::default_at_panic, PoolAllocator::lua_allocator, &m_allocator)
+	, m_luaFoodInfoBuffers(m_allocator, 1000)
+	, m_luaSegmentInfoBuffers(m_allocator, 1000)
 	, m_self(bot, bot.getGUID())
 	, m_script(script)
 {
 	LuaFoodInfo::Register(m_lua_state);
-	m_luaFoodInfoTable.reserve(1000);
+	FoodInfoView::Register(m_lua_state, "FoodInfoList");
 
 	LuaSegmentInfo::Register(m_lua_state);
-	m_luaSegmentInfoTable.reserve(1000);
+	SegmentInfoView::Register(m_lua_state, "SegmentInfoList");
 
 	LuaSelfInfo::Register(m_lua_state);
 }
@@ -136,8 +141,14 @@ sol::environment LuaBot::createEnvironment()
 {
 	auto env = sol::environment(m_lua_state, sol::create);
 	env["self"] = &m_self;
-	env["findFood"] = [this](real_t radius, real_t min_size) { return sol::as_table(apiFindFood(radius, min_size)); };
-	env["findSegments"] = [this](real_t radius, bool include_self) { return sol::as_table(apiFindSegments(radius, include_self)); };
+	env["findFood"] = [this](real_t radius, real_t min_size, sol::optional<std::size_t> max_results, sol::optional<real_t> max_angle)
+	{
+		return apiFindFood(radius, min_size, max_results.value_or(SIZE_MAX), max_angle.value_or(M_PI));
+	};
+	env["findSegments"] = [this](real_t radius, bool include_self, sol::optional<std::size_t> max_results, sol::optional<real_t> max_angle)
+	{
+		return apiFindSegments(radius, include_self, max_results.value_or(SIZE_MAX), max_angle.value_or(M_PI));
+	};
 	env["log"] = [this](std::string v) { return apiLog(v); };
 
 	for (auto& func: std::vector<std::string>{
@@ -185,84 +196,142 @@ sol::table LuaBot::createFunctionTable(const std::string &obj, const std::vector
 	return table;
 }
 
-std::vector<LuaFoodInfo>& LuaBot::apiFindFood(real_t radius, real_t min_size)
+void LuaBot::Candidates::clear()
+{
+	x.clear();
+	y.clear();
+	value.clear();
+	bots.clear();
+}
+
+void LuaBot::Candidates::computePolarCoordinates(real_t heading)
+{
+	distance.resize(x.size());
+	direction.resize(x.size());
+	fastmath::polarCoordinates(x.data(), y.data(), x.size(), heading, distance.data(), direction.data());
+}
+
+/*!
+ * Sort the results and keep only the first maxResults entries. If only a few
+ * results are requested, just these are sorted (partial sort).
+ */
+template <class Vector, class Compare> static void sortResults(Vector& results, std::size_t maxResults, Compare compare)
+{
+	if (maxResults < results.size())
+	{
+		std::partial_sort(results.begin(), results.begin() + maxResults, results.end(), compare);
+		results.erase(results.begin() + maxResults, results.end());
+	}
+	else
+	{
+		std::sort(results.begin(), results.end(), compare);
+	}
+}
+
+LuaBot::FoodInfoView LuaBot::apiFindFood(real_t radius, real_t min_size, std::size_t max_results, real_t max_angle)
 {
-	m_luaFoodInfoTable.clear();
+	auto result = m_luaFoodInfoBuffers.acquire();
+	if (max_results == 0)
+	{
+		return FoodInfoView(result);
+	}
 
 	auto head_pos = m_bot.getSnake()->getHeadPosition();
 	real_t heading = m_bot.getHeading();
 
 	radius = std::min(radius, m_bot.getSightRadius());
+	real_t radiusSquared = radius * radius;
 
-	auto field = m_bot.getField();
-	for (auto &food: field->getFoodMap().getRegion(head_pos, radius))
-	{
-		if (food.getValue()>=min_size)
+	m_candidates.clear();
+	m_bot.getField()->getFoodQueryMap().forEachInRegion(head_pos, radius,
+		[&](const Field::FoodQueryItem& food, real_t relX, real_t relY)
 		{
-			Vector2D relPos = field->unwrapRelativeCoords(food.pos() - head_pos);
-			real_t direction = static_cast<real_t>(atan2(relPos.y(), relPos.x())) - heading;
-			while (direction < -M_PI) { direction += 2*M_PI; }
-			while (direction >  M_PI) { direction -= 2*M_PI; }
-			auto distance = relPos.norm();
-			if (distance>radius) { continue; }
-
-			m_luaFoodInfoTable.emplace_back(
-				relPos.x(),
-				relPos.y(),
-				food.getValue(),
-				direction,
-				distance
-			);
+			if (food.value<min_size) { return; }
+			if ((relX*relX + relY*relY)>radiusSquared) { return; }
+
+			m_candidates.x.push_back(relX);
+			m_candidates.y.push_back(relY);
+			m_candidates.value.push_back(food.value);
 		}
+	);
+
+	m_candidates.computePolarCoordinates(heading);
+
+	for (std::size_t i = 0; i < m_candidates.x.size(); i++)
+	{
+		if (std::abs(m_candidates.direction[i])>max_angle) { continue; }
+
+		result->emplace_back(
+			m_candidates.x[i],
+			m_candidates.y[i],
+			m_candidates.value[i],
+			m_candidates.direction[i],
+			m_candidates.distance[i]
+		);
 	}
 
-	std::sort(
-		m_luaFoodInfoTable.begin(),
-		m_luaFoodInfoTable.end(),
+	sortResults(
+		*result,
+		max_results,
 		[](const LuaFoodInfo& a, const LuaFoodInfo& b) { return a.v > b.v; }
 	);
 
-	return m_luaFoodInfoTable;
+	return FoodInfoView(result);
 }
 
-std::vector<LuaSegmentInfo>& LuaBot::apiFindSegments(real_t radius, bool include_self)
+LuaBot::SegmentInfoView LuaBot::apiFindSegments(real_t radius, bool include_self, std::size_t max_results, real_t max_angle)
 {
-	m_luaSegmentInfoTable.clear();
+	auto result = m_luaSegmentInfoBuffers.acquire();
+	if (max_results == 0)
+	{
+		return SegmentInfoView(result);
+	}
 
 	auto pos = m_bot.getSnake()->getHeadPosition();
 	real_t heading = m_bot.getHeading();
 	radius = std::min(radius, m_bot.getSightRadius());
-	auto self_id = m_bot.getGUID();
+	const Bot* self = &m_bot;
 
+	m_candidates.clear();
 	auto field = m_bot.getField();
-	for (auto &segmentInfo: field->getSegmentInfoMap().getRegion(pos, radius + m_bot.getField()->getMaxSegmentRadius()))
+	field->getSegmentQueryMap().forEachInRegion(pos, radius + field->getMaxSegmentRadius(),
+		[&](const Field::SegmentQueryItem& segment, real_t relX, real_t relY)
+		{
+			if (!include_self && (segment.bot == self)) { return; }
+
+			real_t maxDistance = radius + segment.radius;
+			if ((relX*relX + relY*relY) > (maxDistance*maxDistance)) { return; }
+
+			m_candidates.x.push_back(relX);
+			m_candidates.y.push_back(relY);
+			m_candidates.value.push_back(segment.radius);
+			m_candidates.bots.push_back(segment.bot);
+		}
+	);
+
+	m_candidates.computePolarCoordinates(heading);
+
+	for (std::size_t i = 0; i < m_candidates.x.size(); i++)
 	{
-		if (!include_self && (segmentInfo.bot->getGUID() == self_id)) { continue; }		
-		real_t segmentRadius = segmentInfo.bot->getSnake()->getSegmentRadius();
-		Vector2D relPos = field->unwrapRelativeCoords(segmentInfo.pos() - pos);
-		real_t distance = relPos.norm();
-		if (distance > (radius+segmentRadius)) { continue; }
-
-		real_t direction = atan2(relPos.y(), relPos.x()) - heading;
-		if (direction < -M_PI) { direction += 2*M_PI; }
-		if (direction >  M_PI) { direction -= 2*M_PI; }
-		m_luaSegmentInfoTable.emplace_back(
-			segmentInfo.bot.get(),
-			relPos.x(),
-			relPos.y(),
-			segmentRadius,
-			direction,
-			distance
+		if (std::abs(m_candidates.direction[i]) > max_angle) { continue; }
+
+		result->emplace_back(
+			m_candidates.bots[i],
+			m_candidates.x[i],
+			m_candidates.y[i],
+			m_candidates.value[i],
+			m_candidates.direction[i],
+			m_candidates.distance[i]
 		);
 	}
 
-	std::sort(
-		m_luaSegmentInfoTable.begin(),
-		m_luaSegmentInfoTable.end(),
+	sortResults(
+		*result,
+		max_results,
 		[](const LuaSegmentInfo& a, const LuaSegmentInfo& b) { return a.dist < b.dist; }
 	);
 
-	return m_luaSegmentInfoTable;
+	return SegmentInfoView(result);
 }
 
 bool LuaBot::apiLog(std::string data)
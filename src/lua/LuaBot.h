@@ -23,11 +23,16 @@
 #include "lua/LuaSelfInfo.h"
 #include "lua/LuaFoodInfo.h"
 #include "lua/LuaSegmentInfo.h"
+#include "lua/LuaResultView.h"
 
 class Bot;
 class LuaBot
 {
 	public:
+		typedef LuaResultView<LuaFoodInfo> FoodInfoView;
+		typedef LuaResultView<LuaSegmentInfo> SegmentInfoView;
+
+
 		LuaBot(Bot &bot, std::string script);
 		bool init(std::string &initErrorMessage);
 		bool step(float &directionChange, bool &boost);
@@ -36,12 +41,27 @@ class LuaBot
 		uint32_t getDogTag() { return m_self.getDogTag(); }
 
 	private:
+		/*!
+		 * Items found by a query. Direction and distance are calculated for
+		 * all of them in one batch before the results are filtered.
+		 */
+		struct Candidates
+		{
+			std::vector<real_t> x, y, distance, direction;
+			std::vector<real_t> value; //!< food value or segment radius
+			std::vector<Bot*> bots;    //!< segment owners (findSegments only)
+
+			void clear();
+			void computePolarCoordinates(real_t heading);
+		};
+
 		Bot& m_bot;
 		PoolAllocator m_allocator;
 		sol::state m_lua_state;
 		sol::environment m_lua_safe_env;
-		std::vector<LuaFoodInfo> m_luaFoodInfoTable;
-		std::vector<LuaSegmentInfo> m_luaSegmentInfoTable;
+		FoodInfoView::BufferPool m_luaFoodInfoBuffers;
+		SegmentInfoView::BufferPool m_luaSegmentInfoBuffers;
+		Candidates m_candidates;
 		sol::protected_function m_setQuotaFunc;
 		sol::protected_function m_clearQuotaFunc;
 		LuaSelfInfo m_self;
@@ -52,8 +72,23 @@ class LuaBot
 		sol::environment createEnvironment();
 		sol::table createFunctionTable(const std::string& obj, const std::vector<std::string>& items);
 
-		std::vector<LuaFoodInfo>& apiFindFood(real_t radius, real_t min_size);
-		std::vector<LuaSegmentInfo>& apiFindSegments(real_t radius, bool include_self);
+		/*!
+		 * Find food around the head, sorted by value (largest first).
+		 *
+		 * \param radius       Search radius (limited to the sight radius).
+		 * \param min_size     Minimum value of returned food items.
+		 * \param max_results  Maximum number of returned items. Only this many
+		 *                     items are sorted.
+		 * \param max_angle    Only return items within +/- max_angle (radians)
+		 *                     of the current heading.
+		 */
+		FoodInfoView apiFindFood(real_t radius, real_t min_size, std::size_t max_results, real_t max_angle);
+
+		/*!
+		 * Find snake segments around the head, sorted by distance (nearest
+		 * first). max_results and max_angle work like in apiFindFood().
+		 */
+		SegmentInfoView apiFindSegments(real_t radius, bool include_self, std::size_t max_results, real_t max_angle);
 		bool apiLog(std::string data);
 		void apiCallInit();
 
@@ -0,0 +1,172 @@
+/*
+ * Schlangenprogrammiernacht: A programming game for GPN18.
+ * Copyright (C) 2018  bytewerk
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <sol.hpp>
+#include "PoolAllocator.h"
+
+/*!
+ * Read-only Lua view on a vector of query results.
+ *
+ * Instead of building a new Lua table for every call, the view is pushed as a
+ * single userdata. Lua indexes directly into the C++ vector via the __index
+ * and __len metamethods; only the elements a script actually touches are
+ * converted to Lua objects. pairs(), ipairs() and view:pairs() iterate like
+ * they did over the old tables.
+ *
+ * Each view keeps its buffer alive, so a result stays valid even if the bot
+ * calls the same API function again before it is done with it.
+ */
+template <class T> class LuaResultView
+{
+	public:
+		typedef std::vector<T, PoolStdAllocator<T>> Buffer;
+
+		/*!
+		 * Set of reusable result buffers.
+		 *
+		 * A buffer is handed out again as soon as no Lua view refers to it any
+		 * more, so in steady state no memory is allocated per call. At most
+		 * MAX_BUFFERS are kept for reuse; if the script keeps more results
+		 * alive, additional buffers are allocated per call and freed with
+		 * their view. All buffers live in the bot's memory pool, so results
+		 * kept alive by the script count against its memory limit.
+		 */
+		class BufferPool
+		{
+			public:
+				static constexpr const std::size_t MAX_BUFFERS = 8;
+
+				BufferPool(PoolAllocator &allocator, std::size_t reserveCount)
+					: m_allocator(allocator)
+					, m_reserveCount(reserveCount)
+				{
+				}
+
+				/*!
+				 * Get an empty buffer which is not referenced by any view.
+				 */
+				std::shared_ptr<Buffer> acquire(void)
+				{
+					auto buffer = findUnused();
+					if (buffer)
+					{
+						return buffer;
+					}
+
+					buffer = std::make_shared<Buffer>(PoolStdAllocator<T>(m_allocator));
+					if (m_buffers.size() < MAX_BUFFERS)
+					{
+						buffer->reserve(m_reserveCount);
+						m_buffers.push_back(buffer);
+					}
+					return buffer;
+				}
+
+			private:
+				PoolAllocator &m_allocator;
+				std::size_t m_reserveCount;
+				std::vector<std::shared_ptr<Buffer>> m_buffers;
+
+				std::shared_ptr<Buffer> findUnused()
+				{
+					for (auto &buffer: m_buffers)
+					{
+						if (buffer.use_count() == 1)
+						{
+							buffer->clear();
+							return buffer;
+						}
+					}
+					return nullptr;
+				}
+		};
+
+		LuaResultView(std::shared_ptr<const Buffer> buffer)
+			: m_buffer(buffer)
+		{
+		}
+
+		std::size_t size() const
+		{
+			return m_buffer->size();
+		}
+
+		/*!
+		 * __index handler: returns a copy of the element at the given 1-based
+		 * index or nil if the key is not a valid index.
+		 */
+		sol::object get(sol::stack_object key, sol::this_state L) const
+		{
+			if (!key.is<std::size_t>())
+			{
+				return sol::make_object(L, sol::nil);
+			}
+
+			std::size_t index = key.as<std::size_t>();
+			if ((index < 1) || (index > size()))
+			{
+				return sol::make_object(L, sol::nil);
+			}
+
+			return sol::make_object(L, (*m_buffer)[index-1]);
+		}
+
+		static void Register(sol::state& lua, const std::string& name)
+		{
+			lua.new_usertype<LuaResultView<T>>(
+				name,
+				sol::meta_function::index, &LuaResultView<T>::get,
+				sol::meta_function::length, &LuaResultView<T>::size,
+				sol::meta_function::pairs, &LuaResultView<T>::pairs,
+				sol::meta_function::ipairs, &LuaResultView<T>::pairs,
+				"pairs", &LuaResultView<T>::pairs
+			);
+		}
+
+	private:
+		std::shared_ptr<const Buffer> m_buffer;
+
+		static std::tuple<sol::object, sol::object> next(const LuaResultView<T>& view, sol::stack_object key, sol::this_state L)
+		{
+			std::size_t index = key.is<std::size_t>() ? key.as<std::size_t>() : 0;
+			if (index >= view.size())
+			{
+				return std::make_tuple(sol::make_object(L, sol::nil), sol::make_object(L, sol::nil));
+			}
+
+			return std::make_tuple(
+				sol::make_object(L, index+1),
+				sol::make_object(L, (*view.m_buffer)[index])
+			);
+		}
+
+		static std::tuple<sol::object, sol::stack_object, sol::object> pairs(sol::stack_object view, sol::this_state L)
+		{
+			return std::make_tuple(
+				sol::make_object(L, &LuaResultView<T>::next),
+				view,
+				sol::make_object(L, 0)
+			);
+		}
+};
@@ -19,6 +19,10 @@
 #include <cassert>
 #include <cstring>
 #include <iostream>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "PoolAllocator.h"
 
@@ -94,12 +98,12 @@ std::size_t PoolAllocator::bytesToBlocks(std::size_t bytes)
 
 uint8_t* PoolAllocator::blockIdxToPtr(std::size_t block)
 {
-	return m_pool.data() + (m_blockSize * block);
+	return m_pool + (m_blockSize * block);
 }
 
 std::size_t PoolAllocator::ptrToBlockIdx(void *ptr)
 {
-	return static_cast<std::size_t>(reinterpret_cast<uint8_t*>(ptr) - m_pool.data()) / m_blockSize;
+	return static_cast<std::size_t>(reinterpret_cast<uint8_t*>(ptr) - m_pool) / m_blockSize;
 }
 
 void PoolAllocator::trackUsage(std::size_t oldSize, std::size_t newSize)
@@ -111,6 +115,24 @@ void PoolAllocator::trackUsage(std::size_t oldSize, std::size_t newSize)
 	}
 }
 
+void PoolAllocator::releasePages(std::size_t startBlock, std::size_t blocks)
+{
+	std::size_t first = startBlock * m_blockSize;
+	std::size_t last = (startBlock + blocks) * m_blockSize;
+
+	// only whole pages can be released, partially used ones stay committed
+	first = (first + m_pageSize - 1) / m_pageSize * m_pageSize;
+	last = last / m_pageSize * m_pageSize;
+
+	if(last <= first) {
+		return;
+	}
+
+	PA_DEBUG(std::cerr << "PoolAllocator: releasing " << (last - first) / m_pageSize << " pages" << std::endl);
+
+	madvise(m_pool + first, last - first, MADV_DONTNEED);
+}
+
 /* Public methods */
 
 PoolAllocator::PoolAllocator(std::size_t bytes, std::size_t blockSize)
@@ -121,7 +143,18 @@ PoolAllocator::PoolAllocator(std::size_t bytes, std::size_t blockSize)
 		m_numBlocks++;
 	}
 
-	m_pool.resize(m_numBlocks * m_blockSize);
+	m_pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+	m_poolSize = m_numBlocks * m_blockSize;
+
+	// reserve address space only, pages are committed on first access
+	void *pool = mmap(nullptr, m_poolSize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if(pool == MAP_FAILED) {
+		throw std::bad_alloc();
+	}
+
+	m_pool = reinterpret_cast<uint8_t*>(pool);
 
 	m_curBlockIdx = 0;
 }
@@ -132,6 +165,8 @@ PoolAllocator::~PoolAllocator()
 	std::cerr << "PoolAllocator: Destroying pool: remaining memory: " << m_currentUsage << " blocks; Max: " << m_maxUsage << " blocks" << std::endl;
 	std::cerr << "PoolAllocator: Destroying pool: Number of allocations: " << m_numAllocs << std::endl;
 #endif // DEBUG_POOLALLOCATOR_STATS
+
+	munmap(m_pool, m_poolSize);
 }
 
 void* PoolAllocator::allocate(std::size_t bytes)
@@ -187,6 +222,7 @@ void* PoolAllocator::reallocate(void *ptr, std::size_t bytes)
 		m_blockMap[origStartBlock] = newBlocks;
 
 		trackUsage(oldBlocks, newBlocks);
+		releasePages(origStartBlock + newBlocks, oldBlocks - newBlocks);
 
 		return ptr;
 	} else {
@@ -244,6 +280,7 @@ void PoolAllocator::deallocate(void *ptr)
 	m_blockMap.erase(block);
 
 	trackUsage(length, 0);
+	releasePages(block, length);
 }
 
 void PoolAllocator::debugPrint(void)
@@ -21,13 +21,24 @@
 #include <cstddef>
 #include <cstdint>
 
+#include <new>
 #include <vector>
 #include <map>
 
+/*!
+ * Block based allocator for the Lua states.
+ *
+ * The pool memory is reserved as an anonymous mapping. The kernel only commits
+ * pages when they are touched for the first time, so a fresh pool does not
+ * cost any RSS and no time is spent zeroing it. Pages of freed blocks are
+ * returned to the kernel with madvise(MADV_DONTNEED).
+ */
 class PoolAllocator
 {
 	private:
-		std::vector<uint8_t> m_pool;
+		uint8_t*             m_pool;
+		std::size_t          m_poolSize;
+		std::size_t          m_pageSize;
 
 		std::map<std::size_t, std::size_t> m_blockMap; //!< Allocated Block Map (maps block-index to length)
 
@@ -88,10 +99,23 @@ class PoolAllocator
 		 */
 		void trackUsage(std::size_t oldSize, std::size_t newSize);
 
+		/*!
+		 * Give all pages which are completely inside the given block range back
+		 * to the kernel. The memory stays reserved and reads as zero when it is
+		 * touched again.
+		 *
+		 * \param startBlock    First block of the range.
+		 * \param blocks        Number of blocks in the range.
+		 */
+		void releasePages(std::size_t startBlock, std::size_t blocks);
+
 	public:
 		PoolAllocator(std::size_t bytes, std::size_t blockSize);
 		~PoolAllocator();
 
+		PoolAllocator(const PoolAllocator&) = delete;
+		PoolAllocator& operator=(const PoolAllocator&) = delete;
+
 		void* allocate(std::size_t bytes);
 		void* reallocate(void *ptr, std::size_t bytes);
 		void  deallocate(void *ptr);
@@ -112,3 +136,54 @@ class PoolAllocator
 		 */
 		static void* lua_allocator(void *ud, void *ptr, size_t osize, size_t nsize);
 };
+
+/*!
+ * Standard library allocator which takes its memory from a PoolAllocator, so
+ * C++ containers owned by a bot count against the bot's memory limit.
+ *
+ * Throws std::bad_alloc when the pool is exhausted.
+ */
+template <class T> class PoolStdAllocator
+{
+	public:
+		typedef T value_type;
+
+		PoolStdAllocator(PoolAllocator &pool)
+			: m_pool(&pool)
+		{
+		}
+
+		template <class U> PoolStdAllocator(const PoolStdAllocator<U> &other)
+			: m_pool(other.pool())
+		{
+		}
+
+		T* allocate(std::size_t n)
+		{
+			void *ptr = m_pool->allocate(n * sizeof(T));
+			if(!ptr) {
+				throw std::bad_alloc();
+			}
+			return static_cast<T*>(ptr);
+		}
+
+		void deallocate(T *ptr, std::size_t)
+		{
+			m_pool->deallocate(ptr);
+		}
+
+		PoolAllocator* pool() const { return m_pool; }
+
+	private:
+		PoolAllocator *m_pool;
+};
+
+template <class T, class U> bool operator==(const PoolStdAllocator<T> &a, const PoolStdAllocator<U> &b)
+{
+	return a.pool() == b.pool();
+}
+
+template <class T, class U> bool operator!=(const PoolStdAllocator<T> &a, const PoolStdAllocator<U> &b)
+{
+	return a.pool() != b.pool();
+}
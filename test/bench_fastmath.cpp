@@ -0,0 +1,122 @@
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "FastMath.h"
+
+// reference implementation, as used by the Lua API before
+static void polarCoordinatesScalar(const real_t *x, const real_t *y, std::size_t count,
+		real_t heading, real_t *distance, real_t *direction)
+{
+	for(std::size_t i = 0; i < count; i++) {
+		real_t d = static_cast<real_t>(atan2(y[i], x[i])) - heading;
+		while (d < -M_PI) { d += 2*M_PI; }
+		while (d >  M_PI) { d -= 2*M_PI; }
+		direction[i] = d;
+		distance[i] = Vector2D(x[i], y[i]).norm();
+	}
+}
+
+static double angleError(double a, double b)
+{
+	double e = std::fabs(a - b);
+	return std::min(e, 2*M_PI - e);
+}
+
+static int check_accuracy(void)
+{
+	std::mt19937 gen(1337);
+	std::uniform_real_distribution<real_t> pos(-500, 500);
+	std::uniform_real_distribution<real_t> angle(-M_PI, M_PI);
+
+	const std::size_t count = 1000003;
+	std::vector<real_t> x(count), y(count), dist(count), dir(count);
+	for(std::size_t i = 0; i < count; i++) {
+		x[i] = pos(gen);
+		y[i] = pos(gen);
+	}
+
+	// include the special cases
+	x[0] = 0; y[0] = 0;
+	x[1] = 0; y[1] = 1;
+	x[2] = -1; y[2] = 0;
+	x[3] = 1; y[3] = 1;
+
+	real_t heading = angle(gen);
+	fastmath::polarCoordinates(x.data(), y.data(), count, heading, dist.data(), dir.data());
+
+	double maxAtanError = 0, maxDirError = 0, maxDistError = 0;
+	for(std::size_t i = 0; i < count; i++) {
+		double ref = std::atan2(static_cast<double>(y[i]), static_cast<double>(x[i]));
+		maxAtanError = std::max(maxAtanError, angleError(fastmath::atan2(y[i], x[i]), ref));
+		maxDirError = std::max(maxDirError, angleError(dir[i], ref - heading));
+		maxDistError = std::max(maxDistError, std::fabs(dist[i] - std::hypot(x[i], y[i])) / std::max(1.0, std::hypot(static_cast<double>(x[i]), static_cast<double>(y[i]))));
+
+		if(std::fabs(dir[i]) > M_PI + 1e-6) {
+			std::cerr << "direction not normalized: " << dir[i] << std::endl;
+			return 1;
+		}
+	}
+
+	std::cerr << "max atan2 error:     " << maxAtanError << " rad" << std::endl;
+	std::cerr << "max direction error: " << maxDirError << " rad" << std::endl;
+	std::cerr << "max distance error:  " << maxDistError << " (relative)" << std::endl;
+
+	if((maxAtanError > fastmath::ATAN2_MAX_ERROR) || (maxDirError > fastmath::ATAN2_MAX_ERROR)) {
+		std::cerr << "error exceeds fastmath::ATAN2_MAX_ERROR!" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+template <class Func> static double measure(Func func, std::size_t count)
+{
+	std::mt19937 gen(42);
+	std::uniform_real_distribution<real_t> pos(-300, 300);
+
+	std::vector<real_t> x(count), y(count), dist(count), dir(count);
+	for(std::size_t i = 0; i < count; i++) {
+		x[i] = pos(gen);
+		y[i] = pos(gen);
+	}
+
+	std::size_t rounds = 10000000 / count;
+	real_t checksum = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for(std::size_t r = 0; r < rounds; r++) {
+		func(x.data(), y.data(), count, 0.001f * r, dist.data(), dir.data());
+		checksum += dir[r % count];
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	// keep the compiler from dropping the calculations
+	if(checksum == 12345) {
+		std::cerr << checksum;
+	}
+
+	return std::chrono::duration<double, std::nano>(end - start).count() / (rounds * count);
+}
+
+int main(void)
+{
+	if(check_accuracy() != 0) {
+		return 1;
+	}
+
+	for(std::size_t count: {50, 500, 5000}) {
+		double scalar = measure(polarCoordinatesScalar, count);
+		double batched = measure(fastmath::polarCoordinates, count);
+
+		std::cerr << count << " candidates: "
+			<< "scalar " << scalar << " ns, "
+			<< "batched " << batched << " ns per candidate, "
+			<< "speedup " << scalar / batched << "x" << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+
+# Measures the bandwidth of the update stream with and without compression.
+#
+# usage: measure_compression.py [seconds] [zstd [dictionary]]
+#
+# Without "zstd", the stream is received uncompressed and the size it would
+# have with zstd is estimated by compressing each frame locally (this needs
+# the "zstandard" module). Set DUMP_DIR to store the raw frames, e.g. for
+# training a dictionary with "zstd --train DUMP_DIR/* -o dictionary".
+
+import os
+import socket
+import struct
+import sys
+import time
+
+import msgpack
+
+MESSAGE_TYPE_STREAM_COMPRESSION = 0x02
+MESSAGE_TYPE_TICK = 0x10
+MESSAGE_TYPE_CLIENT_COMPRESSION = 0x82
+COMPRESSION_ZSTD = 1
+
+duration = float(sys.argv[1]) if len(sys.argv) > 1 else 10
+use_zstd = len(sys.argv) > 2 and sys.argv[2] == 'zstd'
+dictionary_path = sys.argv[3] if len(sys.argv) > 3 else None
+dump_dir = os.environ.get('DUMP_DIR')
+
+try:
+    import zstandard
+    if dictionary_path:
+        with open(dictionary_path, 'rb') as f:
+            dictionary = zstandard.ZstdCompressionDict(f.read())
+        compressor = zstandard.ZstdCompressor(level=3, dict_data=dictionary)
+        decompressor = zstandard.ZstdDecompressor(dict_data=dictionary)
+    else:
+        compressor = zstandard.ZstdCompressor(level=3)
+        decompressor = zstandard.ZstdDecompressor()
+except ImportError:
+    if use_zstd:
+        raise
+    compressor = None
+
+s = socket.create_connection( ('localhost', 9010) )
+
+f = s.makefile('b')
+
+def read_block():
+    lengthstr = f.read(4)
+    length, = struct.unpack('>I', lengthstr)
+    data = b''
+    while len(data) < length:
+        data += f.read(length - len(data))
+    return data
+
+def split_messages(data):
+    while data:
+        length, = struct.unpack('>I', data[:4])
+        yield msgpack.loads(data[4:4+length])
+        data = data[4+length:]
+
+if use_zstd:
+    request = msgpack.dumps([1, MESSAGE_TYPE_CLIENT_COMPRESSION, COMPRESSION_ZSTD])
+    s.sendall(struct.pack('>I', len(request)) + request)
+
+compressed = False
+wire_bytes = 0
+raw_bytes = 0
+estimated_bytes = 0
+decompress_time = 0
+frames = 0
+frame = b''
+
+start = time.monotonic()
+while time.monotonic() - start < duration:
+    data = read_block()
+    wire_bytes += len(data) + 4
+
+    if compressed:
+        t = time.perf_counter()
+        data = decompressor.decompress(data)
+        decompress_time += time.perf_counter() - t
+        messages = list(split_messages(data))
+    else:
+        data = struct.pack('>I', len(data)) + data
+        messages = [msgpack.loads(data[4:])]
+
+    raw_bytes += len(data)
+    frame += data
+
+    for message in messages:
+        if message[1] == MESSAGE_TYPE_STREAM_COMPRESSION:
+            compressed = (message[2] == COMPRESSION_ZSTD)
+            print("stream compression: {}".format(message[2]))
+
+        elif message[1] == MESSAGE_TYPE_TICK:
+            # the tick closes a frame
+            if compressor and not compressed:
+                estimated_bytes += len(compressor.compress(frame)) + 4
+            if dump_dir:
+                with open(os.path.join(dump_dir, 'frame{:06d}'.format(frames)), 'wb') as out:
+                    out.write(frame)
+            frames += 1
+            frame = b''
+
+elapsed = time.monotonic() - start
+
+print("frames:        {:d} in {:.1f} s".format(frames, elapsed))
+print("uncompressed:  {:.1f} kB/s".format(raw_bytes / elapsed / 1000))
+print("on the wire:   {:.1f} kB/s".format(wire_bytes / elapsed / 1000))
+if estimated_bytes:
+    print("zstd estimate: {:.1f} kB/s".format(estimated_bytes / elapsed / 1000))
+if decompress_time:
+    print("decompression: {:.1f} ms/s".format(decompress_time / elapsed * 1000))
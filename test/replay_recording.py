@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+
+# Streams a game recording (see src/Recording.h) to viewers, without running
+# the game server.
+#
+# usage: replay_recording.py RECORDING [speed [start_frame [port]]]
+#
+# Every viewer connecting to the port (default 9010) gets the recording from
+# the first keyframe at or after start_frame, at speed times the normal frame
+# rate. Speed 0 sends the frames as fast as the viewer accepts them, e.g. for
+# profiling a viewer. Where frames are missing from the recording, the replay
+# continues with the world state of the next keyframe.
+
+import mmap
+import socket
+import struct
+import sys
+import threading
+import time
+
+FRAME_RATE = 60
+
+HEADER = struct.Struct('=8sII')
+BLOCK_HEADER = struct.Struct('=IIQ')
+INDEX_ENTRY = struct.Struct('=IIQQ')
+
+MAGIC = b'SPNREC\0\0'
+FORMAT_VERSION = 1
+BYTE_ORDER = 0x01020304
+
+BLOCK_GAME_INFO = 1
+BLOCK_WORLD_STATE = 2
+BLOCK_UPDATE = 3
+
+INDEX_KEYFRAME = 1
+INDEX_AFTER_GAP = 2
+
+
+def map_file(path):
+    with open(path, 'rb') as f:
+        return mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+
+class Recording:
+    def __init__(self, path):
+        self.log = map_file(path)
+        self.index = map_file(path + '.idx')
+
+        magic, version, byte_order = HEADER.unpack_from(self.log, 0)
+        if magic != MAGIC or version != FORMAT_VERSION or byte_order != BYTE_ORDER:
+            raise ValueError(path + ' is not a recording of this version')
+
+        block_type, _, _, payload = self.block(HEADER.size)
+        if block_type != BLOCK_GAME_INFO:
+            raise ValueError(path + ' does not start with the game info')
+        self.game_info = payload
+
+        self.entries = [INDEX_ENTRY.unpack_from(self.index, i * INDEX_ENTRY.size)
+                        for i in range(len(self.index) // INDEX_ENTRY.size)]
+
+    def block(self, offset):
+        block_type, frame, size = BLOCK_HEADER.unpack_from(self.log, offset)
+        start = offset + BLOCK_HEADER.size
+        return block_type, frame, (size + 7) & ~7, self.log[start:start + size]
+
+    def blocks(self, entry):
+        _, _, offset, size = entry
+        end = offset + size
+        while offset < end:
+            block_type, _, padded_size, payload = self.block(offset)
+            yield block_type, payload
+            offset += BLOCK_HEADER.size + padded_size
+
+    def first_keyframe(self, start_frame, start_index=0):
+        for i in range(start_index, len(self.entries)):
+            frame, flags, _, _ = self.entries[i]
+            if frame >= start_frame and flags & INDEX_KEYFRAME:
+                return i
+        return None
+
+
+def send_world_state(recording, conn, entry):
+    for block_type, payload in recording.blocks(entry):
+        if block_type == BLOCK_WORLD_STATE:
+            conn.sendall(payload)
+
+
+def replay(recording, conn, speed, start_frame):
+    start = recording.first_keyframe(start_frame)
+    if start is None:
+        print('no keyframe at or after frame', start_frame)
+        return
+
+    conn.sendall(recording.game_info)
+
+    # the keyframe holds the state after its frame, so the updates start
+    # with the next one
+    send_world_state(recording, conn, recording.entries[start])
+    last_frame = recording.entries[start][0]
+
+    next_time = time.monotonic()
+    i = start + 1
+    while i < len(recording.entries):
+        entry = recording.entries[i]
+        frame, flags, _, _ = entry
+
+        # frames were dropped or the server restarted: the updates do not
+        # apply to the viewer's state any more
+        if flags & INDEX_AFTER_GAP or frame != last_frame + 1:
+            keyframe = recording.first_keyframe(0, i)
+            if keyframe is None:
+                print('no keyframe after the gap at frame', frame)
+                return
+
+            send_world_state(recording, conn, recording.entries[keyframe])
+            last_frame = recording.entries[keyframe][0]
+            i = keyframe + 1
+            continue
+
+        for block_type, payload in recording.blocks(entry):
+            if block_type == BLOCK_UPDATE:
+                conn.sendall(payload)
+        last_frame = frame
+        i += 1
+
+        if speed > 0:
+            next_time += 1 / (FRAME_RATE * speed)
+            delay = next_time - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+
+
+def serve_viewer(recording, conn, peer, speed, start_frame):
+    print('replaying to', peer)
+    try:
+        with conn:
+            replay(recording, conn, speed, start_frame)
+    except OSError as e:
+        print('connection to', peer, 'closed:', e)
+
+
+def main():
+    if len(sys.argv) < 2:
+        print('usage: replay_recording.py RECORDING [speed [start_frame [port]]]')
+        sys.exit(1)
+
+    recording = Recording(sys.argv[1])
+    speed = float(sys.argv[2]) if len(sys.argv) > 2 else 1
+    start_frame = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    port = int(sys.argv[4]) if len(sys.argv) > 4 else 9010
+
+    keyframes = sum(1 for entry in recording.entries if entry[1] & INDEX_KEYFRAME)
+    print('{} frames, {} keyframes'.format(len(recording.entries), keyframes))
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('', port))
+    server.listen()
+
+    while True:
+        conn, peer = server.accept()
+        threading.Thread(target=serve_viewer, args=(recording, conn, peer, speed, start_frame),
+                         daemon=True).start()
+
+
+if __name__ == '__main__':
+    main()
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 
 #include "lua/PoolAllocator.h"
 
@@ -23,6 +24,26 @@ void test_issue_6(PoolAllocator *alloc)
 	alloc->deallocate(second);
 }
 
+void test_release_pages(void)
+{
+	PoolAllocator alloc(1024*1024, 256);
+
+	// a large block spans whole pages, which are given back when it is freed
+	uint8_t *large = reinterpret_cast<uint8_t*>(alloc.allocate(256*1024));
+	assert(large);
+	std::fill(large, large + 256*1024, 0xAA);
+	alloc.deallocate(large);
+
+	// a released page reads as zero
+	uint8_t *again = reinterpret_cast<uint8_t*>(alloc.allocate(256*1024));
+	if((again != large) || (again[128*1024] != 0)) {
+		std::cerr << "Freed pages were not released!" << std::endl;
+		std::abort();
+	}
+
+	alloc.deallocate(again);
+}
+
 int main(void)
 {
 	srand(1337); // for reproducible results
@@ -32,6 +53,7 @@ int main(void)
 	alloc.debugPrint();
 
 	test_issue_6(&alloc);
+	test_release_pages();
 
 	std::vector<void*> ptrs;
 